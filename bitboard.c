@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bitboard.h"
+#include "chess.h"
+#include "zobrist.h"
+#include "random.h"
+#include "platform.h"
+
+bitboard knight_attacks[64];
+bitboard king_attacks[64];
+bitboard pawn_attacks[2][64];
+
+struct magic bishop_magics[64];
+struct magic rook_magics[64];
+
+// the attack sets for every relevant occupancy of every square, each square's magic points at its own slice
+// the sizes are the sum over all squares of 2^(number of squares in the square's mask)
+static bitboard bishop_attack_table[5248];
+static bitboard rook_attack_table[102400];
+
+// the 8 ray directions a slider can move in, the first 4 move towards higher square indices, the last 4 towards lower ones
+#define DIRECTION_NORTH 0
+#define DIRECTION_EAST 1
+#define DIRECTION_NORTH_EAST 2
+#define DIRECTION_NORTH_WEST 3
+#define DIRECTION_SOUTH 4
+#define DIRECTION_WEST 5
+#define DIRECTION_SOUTH_WEST 6
+#define DIRECTION_SOUTH_EAST 7
+
+static const int direction_rank_offsets[8] = { 1, 0, 1,  1, -1,  0, -1, -1 };
+static const int direction_file_offsets[8] = { 0, 1, 1, -1,  0, -1, -1,  1 };
+
+// rays[direction][square] is every square from square (exclusive) to the edge of the board in that direction
+static bitboard rays[8][64];
+
+bitboard squares_between[64][64];
+bitboard squares_line[64][64];
+
+static struct once bitboards_once = ONCE_INIT;
+
+static bitboard bitboard_from_offsets(int rank, int file, const int *rank_offsets, const int *file_offsets, int n_offsets) {
+	bitboard result = 0;
+	for (int i = 0; i < n_offsets; i++) {
+		int target_rank = rank + rank_offsets[i];
+		int target_file = file + file_offsets[i];
+
+		if (target_rank < 0 || target_rank > 7 || target_file < 0 || target_file > 7)
+			continue;
+
+		result |= SQUARE_BIT(SQUARE_INDEX(target_rank, target_file));
+	}
+	return result;
+}
+
+// the squares attacked along a single ray, stopping at (and including) the first occupied square
+// this is only used to build the magic tables, lookups go through bishop_attacks/rook_attacks
+static bitboard ray_attacks(int square, bitboard occupied, int direction) {
+	bitboard ray = rays[direction][square];
+	bitboard blockers = ray & occupied;
+	if (blockers == 0)
+		return ray;
+
+	// for directions towards higher square indices the nearest blocker is the lowest bit, otherwise the highest one
+	int blocker_square;
+	if (direction < DIRECTION_SOUTH)
+		blocker_square = bitboard_lsb(blockers);
+	else
+		blocker_square = bitboard_msb(blockers);
+
+	return ray ^ rays[direction][blocker_square];
+}
+
+static bitboard slow_bishop_attacks(int square, bitboard occupied) {
+	return ray_attacks(square, occupied, DIRECTION_NORTH_EAST) | ray_attacks(square, occupied, DIRECTION_NORTH_WEST) |
+		ray_attacks(square, occupied, DIRECTION_SOUTH_WEST) | ray_attacks(square, occupied, DIRECTION_SOUTH_EAST);
+}
+
+static bitboard slow_rook_attacks(int square, bitboard occupied) {
+	return ray_attacks(square, occupied, DIRECTION_NORTH) | ray_attacks(square, occupied, DIRECTION_EAST) |
+		ray_attacks(square, occupied, DIRECTION_SOUTH) | ray_attacks(square, occupied, DIRECTION_WEST);
+}
+
+// finds a magic number for the square by trial and error and fills in the square's slice of the attack table
+// returns the number of table entries used by the square
+static int init_magic_for_square(struct magic *magic, bitboard *table, int square, bool is_bishop, uint64_t *random_state) {
+	int rank = SQUARE_RANK(square);
+	int file = SQUARE_FILE(square);
+
+	// the occupancy of the last square of a ray never changes the attacks, so it's left out of the mask
+	// the board edges the slider is standing on still count, otherwise a rook on the a file would ignore a2-a7
+	bitboard edges = ((RANK_1_BITS | RANK_8_BITS) & ~(RANK_1_BITS << (8 * rank))) | ((FILE_A_BITS | FILE_H_BITS) & ~(FILE_A_BITS << file));
+	bitboard mask;
+	if (is_bishop)
+		mask = slow_bishop_attacks(square, 0) & ~edges;
+	else
+		mask = slow_rook_attacks(square, 0) & ~edges;
+
+	int n_mask_bits = bitboard_popcount(mask);
+	int n_occupancies = 1 << n_mask_bits;
+
+	// every subset of the mask along with its attack set, a rook on a corner has the largest mask at 12 squares
+	static bitboard occupancies[4096];
+	static bitboard reference_attacks[4096];
+	static int used_in_try[4096];
+
+	bitboard subset = 0;
+	for (int i = 0; i < n_occupancies; i++) {
+		occupancies[i] = subset;
+		if (is_bishop)
+			reference_attacks[i] = slow_bishop_attacks(square, subset);
+		else
+			reference_attacks[i] = slow_rook_attacks(square, subset);
+		used_in_try[i] = 0;
+
+		subset = (subset - mask) & mask;
+	}
+
+	magic->mask = mask;
+	magic->shift = 64 - n_mask_bits;
+	magic->attacks = table;
+
+	for (int try_number = 1; ; try_number++) {
+		// candidates with few bits set are far more likely to work
+		uint64_t candidate = next_random(random_state) & next_random(random_state) & next_random(random_state);
+		if (bitboard_popcount((mask * candidate) >> 56) < 6)
+			continue;
+
+		magic->magic = candidate;
+
+		bool is_collision_free = true;
+		for (int i = 0; i < n_occupancies; i++) {
+			unsigned int idx = magic_index(magic, occupancies[i]);
+
+			// two occupancies may only share an entry if they have the same attacks
+			if (used_in_try[idx] != try_number) {
+				used_in_try[idx] = try_number;
+				table[idx] = reference_attacks[i];
+			} else if (table[idx] != reference_attacks[i]) {
+				is_collision_free = false;
+				break;
+			}
+		}
+
+		if (is_collision_free)
+			return n_occupancies;
+	}
+}
+
+// what init_bitboards runs, only ever once
+static void build_bitboard_tables(void) {
+	static const int white_pawn_rank_offsets[2] = { 1, 1 };
+	static const int black_pawn_rank_offsets[2] = { -1, -1 };
+	static const int pawn_file_offsets[2] = { -1, 1 };
+
+	for (int rank = 0; rank < 8; rank++) {
+		for (int file = 0; file < 8; file++) {
+			int square = SQUARE_INDEX(rank, file);
+
+			knight_attacks[square] = bitboard_from_offsets(rank, file, knight_move_rank_offsets, knight_move_file_offsets, 8);
+			king_attacks[square] = bitboard_from_offsets(rank, file, king_move_rank_offsets, king_move_file_offsets, 8);
+			pawn_attacks[COLOR_WHITE][square] = bitboard_from_offsets(rank, file, white_pawn_rank_offsets, pawn_file_offsets, 2);
+			pawn_attacks[COLOR_BLACK][square] = bitboard_from_offsets(rank, file, black_pawn_rank_offsets, pawn_file_offsets, 2);
+
+			for (int direction = 0; direction < 8; direction++) {
+				bitboard ray = 0;
+				int target_rank = rank + direction_rank_offsets[direction];
+				int target_file = file + direction_file_offsets[direction];
+				while (target_rank >= 0 && target_rank <= 7 && target_file >= 0 && target_file <= 7) {
+					ray |= SQUARE_BIT(SQUARE_INDEX(target_rank, target_file));
+					target_rank += direction_rank_offsets[direction];
+					target_file += direction_file_offsets[direction];
+				}
+				rays[direction][square] = ray;
+			}
+		}
+	}
+
+	// the direction opposite to direction is (direction + 4) % 8
+	for (int from = 0; from < 64; from++) {
+		for (int direction = 0; direction < 8; direction++) {
+			bitboard ray = rays[direction][from];
+			while (ray) {
+				int to = bitboard_pop_lsb(&ray);
+				squares_between[from][to] = rays[direction][from] & ~rays[direction][to] & ~SQUARE_BIT(to);
+				squares_line[from][to] = rays[direction][from] | rays[(direction + 4) % 8][from] | SQUARE_BIT(from);
+			}
+		}
+	}
+
+	// the magic candidates are seeded the same way every time, so the tables come out identical on every run
+	uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+	int bishop_table_offset = 0;
+	int rook_table_offset = 0;
+	for (int square = 0; square < 64; square++) {
+		bishop_table_offset += init_magic_for_square(&bishop_magics[square], &bishop_attack_table[bishop_table_offset], square, true, &random_state);
+		rook_table_offset += init_magic_for_square(&rook_magics[square], &rook_attack_table[rook_table_offset], square, false, &random_state);
+	}
+	assert(bishop_table_offset == sizeof(bishop_attack_table) / sizeof(bishop_attack_table[0]));
+	assert(rook_table_offset == sizeof(rook_attack_table) / sizeof(rook_attack_table[0]));
+
+	init_zobrist_keys();
+}
+
+// the magic search writes trial entries into the live attack tables, so a second thread building them at the same time
+// would make the first one's attacks wrong while it's still running, run_once makes every other caller wait instead
+void init_bitboards(void) {
+	run_once(&bitboards_once, build_bitboard_tables);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// a bitboard is a set of squares, bit (rank * 8 + file) is set if the square [rank][file] is in the set
+// so a1 is bit 0, h1 is bit 7, a8 is bit 56 and h8 is bit 63
+typedef uint64_t bitboard;
+
+#define SQUARE_INDEX(rank, file) ((rank) * 8 + (file))
+#define SQUARE_RANK(square) ((square) >> 3)
+#define SQUARE_FILE(square) ((square) & 7)
+#define SQUARE_BIT(square) (((bitboard)1) << (square))
+
+// index into per color tables, i.e. bitboard_position::pieces and pawn_attacks
+#define COLOR_WHITE 0
+#define COLOR_BLACK 1
+#define COLOR_INDEX(is_color_white) ((is_color_white) ? COLOR_WHITE : COLOR_BLACK)
+
+#define RANK_1_BITS ((bitboard)0x00000000000000FF)
+#define RANK_8_BITS ((bitboard)0xFF00000000000000)
+#define FILE_A_BITS ((bitboard)0x0101010101010101)
+#define FILE_H_BITS ((bitboard)0x8080808080808080)
+
+#if defined(_MSC_VER)
+static inline int bitboard_lsb(bitboard b) {
+	unsigned long idx;
+	_BitScanForward64(&idx, b);
+	return (int)idx;
+}
+
+static inline int bitboard_msb(bitboard b) {
+	unsigned long idx;
+	_BitScanReverse64(&idx, b);
+	return (int)idx;
+}
+
+static inline int bitboard_popcount(bitboard b) {
+	return (int)__popcnt64(b);
+}
+#else
+static inline int bitboard_lsb(bitboard b) {
+	return __builtin_ctzll(b);
+}
+
+static inline int bitboard_msb(bitboard b) {
+	return 63 - __builtin_clzll(b);
+}
+
+static inline int bitboard_popcount(bitboard b) {
+	return __builtin_popcountll(b);
+}
+#endif
+
+// removes the lowest set square from *b and returns its index, *b must not be empty
+static inline int bitboard_pop_lsb(bitboard *b) {
+	int square = bitboard_lsb(*b);
+	*b &= *b - 1;
+	return square;
+}
+
+// attack sets for the non sliding pieces, indexed by the square the piece is on
+// pawn_attacks is additionally indexed by the pawn's color (COLOR_WHITE or COLOR_BLACK)
+extern bitboard knight_attacks[64];
+extern bitboard king_attacks[64];
+extern bitboard pawn_attacks[2][64];
+
+// squares_between[a][b] is the squares strictly between a and b if they share a rank, file or diagonal, otherwise empty
+// squares_line[a][b] is the whole line through a and b, edge to edge, if they share one, otherwise empty
+extern bitboard squares_between[64][64];
+extern bitboard squares_line[64][64];
+
+// fills in the attack tables above and the zobrist keys, must be called before any of the attack functions are used
+// it is safe to call any number of times from any number of threads, the tables are only ever built once
+// load_fen_to_position and init_engine call it as well, so single threaded programs never have to
+void init_bitboards(void);
+
+// a magic multiplication maps every relevant occupancy around a slider's square to an index into a table of attack sets
+// the tables are built once by init_bitboards and only read afterwards, so every thread can share them
+struct magic {
+	bitboard mask;      // squares whose occupancy can change the attack set, i.e. the slider's rays without their last square
+	uint64_t magic;
+	int shift;          // 64 - number of squares in mask
+	bitboard *attacks;  // this square's slice of the attack table, indexed by magic_index
+};
+
+extern struct magic bishop_magics[64];
+extern struct magic rook_magics[64];
+
+static inline unsigned int magic_index(const struct magic *magic, bitboard occupied) {
+	return (unsigned int)(((occupied & magic->mask) * magic->magic) >> magic->shift);
+}
+
+// squares attacked by a bishop/rook/queen on square, given the set of occupied squares on the board
+// the returned set includes the first blocker in each direction, regardless of its color
+static inline bitboard bishop_attacks(int square, bitboard occupied) {
+	const struct magic *magic = &bishop_magics[square];
+	return magic->attacks[magic_index(magic, occupied)];
+}
+
+static inline bitboard rook_attacks(int square, bitboard occupied) {
+	const struct magic *magic = &rook_magics[square];
+	return magic->attacks[magic_index(magic, occupied)];
+}
+
+static inline bitboard queen_attacks(int square, bitboard occupied) {
+	return bishop_attacks(square, occupied) | rook_attacks(square, occupied);
+}
@@ -1,5 +1,5 @@
 @echo off
-cl /D _CRT_SECURE_NO_WARNINGS /I include\sdl sdl_gui.c chess.c chess_utils.c engine.c /W3 /DEBUG /Z7 /link SDL2.lib SDL2main.lib SDL2_image.lib SDL2_ttf.lib /LIBPATH:lib /SUBSYSTEM:CONSOLE 
+cl /D _CRT_SECURE_NO_WARNINGS /I include\sdl sdl_gui.c chess.c chess_utils.c engine.c bitboard.c zobrist.c platform.c thread_pool.c hash_table.c /W3 /DEBUG /Z7 /link SDL2.lib SDL2main.lib SDL2_image.lib SDL2_ttf.lib /LIBPATH:lib /SUBSYSTEM:CONSOLE 
 set PATH=%PATH%;lib
 del *.obj
 del *.ilk
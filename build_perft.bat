@@ -0,0 +1,3 @@
+@echo off
+cl /O2 /D NDEBUG /D _CRT_SECURE_NO_WARNINGS perft.c chess.c chess_utils.c bitboard.c zobrist.c platform.c thread_pool.c hash_table.c /W3
+del *.obj
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 #include "chess.h"
 #include "chess_utils.h"
+#include "zobrist.h"
 
 static int int_difference(int a, int b) {
 	int signed_diff = a - b;
@@ -18,31 +19,140 @@ static int int_difference(int a, int b) {
 
 
 static void get_king_position(const struct position *position, bool is_king_white, int *rank, int *file) {
-	if (is_king_white) {
-		*rank = position->white_king_rank;
-		*file = position->white_king_file;
-	} else {
-		*rank = position->black_king_rank;
-		*file = position->black_king_file;
+	int king_square = bitboard_lsb(position->bitboards.pieces[COLOR_INDEX(is_king_white)][PIECE_TYPE_KING]);
+	*rank = SQUARE_RANK(king_square);
+	*file = SQUARE_FILE(king_square);
+}
+
+// removes the piece on [rank][file] from both the board and the bitboards, the square must have a piece
+static void remove_piece_from_square(struct position *position, int rank, int file) {
+	int square_idx = SQUARE_INDEX(rank, file);
+	packed_square square = position->board[square_idx];
+	assert(square != EMPTY_SQUARE);
+
+	piece_type piece_type = PACKED_SQUARE_PIECE_TYPE(square);
+	bitboard square_bit = SQUARE_BIT(square_idx);
+	int color = COLOR_INDEX(PACKED_SQUARE_IS_PIECE_WHITE(square));
+	position->bitboards.pieces[color][piece_type] &= ~square_bit;
+	position->bitboards.occupied_by_color[color] &= ~square_bit;
+	position->bitboards.occupied &= ~square_bit;
+	position->hash ^= zobrist_piece_keys[color][piece_type][square_idx];
+	position->piece_counts[color][piece_type]--;
+	position->material[color] -= piece_values[piece_type];
+
+	position->board[square_idx] = EMPTY_SQUARE;
+}
+
+// places a piece on [rank][file], replacing whatever piece was there before
+static void put_piece_on_square(struct position *position, int rank, int file, piece_type piece_type, bool is_piece_white) {
+	if (position->board[SQUARE_INDEX(rank, file)] != EMPTY_SQUARE)
+		remove_piece_from_square(position, rank, file);
+
+	bitboard square_bit = SQUARE_BIT(SQUARE_INDEX(rank, file));
+	int color = COLOR_INDEX(is_piece_white);
+	position->bitboards.pieces[color][piece_type] |= square_bit;
+	position->bitboards.occupied_by_color[color] |= square_bit;
+	position->bitboards.occupied |= square_bit;
+	position->hash ^= zobrist_piece_keys[color][piece_type][SQUARE_INDEX(rank, file)];
+	position->piece_counts[color][piece_type]++;
+	position->material[color] += piece_values[piece_type];
+
+	position->board[SQUARE_INDEX(rank, file)] = PACKED_SQUARE(piece_type, is_piece_white);
+}
+
+void modify_squares_for_castled_rook(struct position *position, int rank, int source_file, int target_file, bool is_rook_white) {
+	remove_piece_from_square(position, rank, source_file);
+	put_piece_on_square(position, rank, target_file, PIECE_TYPE_ROOK, is_rook_white);
+}
+
+void position_to_bitboard_position(const struct position *position, struct bitboard_position *into) {
+	memset(into, 0, sizeof(*into));
+
+	for (int square_idx = 0; square_idx < 64; square_idx++) {
+		packed_square square = position->board[square_idx];
+		if (square == EMPTY_SQUARE)
+			continue;
+
+		bitboard square_bit = SQUARE_BIT(square_idx);
+		int color = COLOR_INDEX(PACKED_SQUARE_IS_PIECE_WHITE(square));
+		into->pieces[color][PACKED_SQUARE_PIECE_TYPE(square)] |= square_bit;
+		into->occupied_by_color[color] |= square_bit;
+		into->occupied |= square_bit;
+	}
+}
+
+void count_pieces(struct position *position) {
+	for (int color = COLOR_WHITE; color <= COLOR_BLACK; color++) {
+		position->material[color] = 0;
+		for (int piece_type = PIECE_TYPE_PAWN; piece_type <= PIECE_TYPE_KING; piece_type++) {
+			int n_pieces = bitboard_popcount(position->bitboards.pieces[color][piece_type]);
+			position->piece_counts[color][piece_type] = (uint8_t)n_pieces;
+			position->material[color] += n_pieces * piece_values[piece_type];
+		}
+	}
+}
+
+void bitboard_position_to_position(const struct bitboard_position *bitboards, struct position *into) {
+	memset(into->board, EMPTY_SQUARE, sizeof(into->board));
+
+	for (int color = COLOR_WHITE; color <= COLOR_BLACK; color++) {
+		for (int piece_type = PIECE_TYPE_PAWN; piece_type <= PIECE_TYPE_KING; piece_type++) {
+			bitboard pieces = bitboards->pieces[color][piece_type];
+			while (pieces) {
+				int square_idx = bitboard_pop_lsb(&pieces);
+				into->board[square_idx] = PACKED_SQUARE(piece_type, color == COLOR_WHITE);
+			}
+		}
 	}
+
+	assert(bitboard_popcount(bitboards->pieces[COLOR_WHITE][PIECE_TYPE_KING]) == 1);
+	assert(bitboard_popcount(bitboards->pieces[COLOR_BLACK][PIECE_TYPE_KING]) == 1);
+
+	into->bitboards = *bitboards;
+	count_pieces(into);
 }
 
-void modify_squares_for_castled_rook(struct square *source_sq, struct square *target_sq, bool is_rook_white) {
-	source_sq->has_piece = false;
+uint64_t position_hash(const struct position *position, bool is_white_to_move) {
+	uint64_t hash = 0;
+
+	for (int color = 0; color < 2; color++) {
+		for (int piece_type = 0; piece_type < 6; piece_type++) {
+			bitboard pieces = position->bitboards.pieces[color][piece_type];
+			while (pieces)
+				hash ^= zobrist_piece_keys[color][piece_type][bitboard_pop_lsb(&pieces)];
+		}
+	}
+
+	hash ^= zobrist_castling_keys[position->castling_rights];
 
-	target_sq->has_piece = true;
-	target_sq->piece_type = PIECE_TYPE_ROOK;
-	target_sq->is_piece_white = is_rook_white;
+	if (position->en_passant_file != NO_EN_PASSANT_FILE)
+		hash ^= zobrist_en_passant_keys[position->en_passant_file];
+
+	if (!is_white_to_move)
+		hash ^= zobrist_black_to_move_key;
+
+	return hash;
 }
 
-static struct position saved_position_states[256];
-static int n_saved_position_states = 0;
+// a move from or to one of the rooks' starting squares means that rook has moved or been captured, either way it can't castle anymore
+static void revoke_castling_rights_for_corner(struct position *position, int rank, int file) {
+	if (rank == 0) {
+		if (file == 0)
+			position->castling_rights &= ~CASTLE_WHITE_QUEENSIDE;
+		else if (file == 7)
+			position->castling_rights &= ~CASTLE_WHITE_KINGSIDE;
+
+	} else if (rank == 7) {
+		if (file == 0)
+			position->castling_rights &= ~CASTLE_BLACK_QUEENSIDE;
+		else if (file == 7)
+			position->castling_rights &= ~CASTLE_BLACK_KINGSIDE;
+	}
+}
 
 // applies move to position without any constraints, the move should be legal if the state of the position intends to be correct after
-void apply_move_to_position(struct position *position, const struct move *move) {
-	saved_position_states[n_saved_position_states] = *position;
-	n_saved_position_states++;
-	
+// records what's needed to take the move back with unmake_move into *undo
+void make_move(struct position *position, const struct move *move, struct undo_info *undo) {
 	assert(move->source_rank >= 0);
 	assert(move->source_rank <= 7);
 	assert(move->source_file >= 0);
@@ -52,378 +162,674 @@ void apply_move_to_position(struct position *position, const struct move *move)
 	assert(move->target_file >= 0);
 	assert(move->target_file <= 7);
 	
-	assert(position->squares[move->source_rank][move->source_file].has_piece);
-	assert(position->squares[move->source_rank][move->source_file].piece_type == move->piece_type);
+	assert(get_square(position, move->source_rank, move->source_file).has_piece);
+	assert(get_square(position, move->source_rank, move->source_file).piece_type == move->piece_type);
+
+	undo->castling_rights = position->castling_rights;
+	undo->en_passant_file = position->en_passant_file;
+	undo->has_captured_piece = move->is_capture;
+	undo->captured_piece_type = move->is_capture ? move->captured_piece_type : PIECE_TYPE_PAWN;
+	undo->hash = position->hash;
+	undo->halfmove_clock = position->halfmove_clock;
+
+	// the pieces' keys are updated as they are taken off and put on squares, the rights' keys are swapped at the end
+	position->hash ^= zobrist_castling_keys[undo->castling_rights];
+	if (undo->en_passant_file != NO_EN_PASSANT_FILE)
+		position->hash ^= zobrist_en_passant_keys[undo->en_passant_file];
 
 	// check for whether the move is a castle, since the rook castled with needs to move here
 	// this only moves the rook that is being castled with, the king's move is taken care of by the general piece move code below
 	if (move->piece_type == PIECE_TYPE_KING) {
 		if (move->is_piece_white) {
-			position->white_king_rank = move->target_rank;
-			position->white_king_file = move->target_file;
-
 			// if the source square is the king's starting square && target square is a castled position
 			// AND the king can castle in that direction
 			// then we move both the king and rook to the appropriate squares
 			// e.g. king move from e1 to g1 means we move rook from h1 to f1 as well
 			if (move->source_rank == 0 && move->source_file == 4) {
 				
-				if (move->target_rank == 0 && move->target_file == 6) { // white kingside castles
-					struct square *h1_square = &position->squares[0][7];
-					struct square *f1_square = &position->squares[0][5];
-
-					modify_squares_for_castled_rook(h1_square, f1_square, move->is_piece_white);
-
-				} else if (move->target_rank == 0 && move->target_file == 2) { // white queenside castles
-					struct square *a1_square = &position->squares[0][0];
-					struct square *d1_square = &position->squares[0][3];
+				if (move->target_rank == 0 && move->target_file == 6) { // white kingside castles, h1 rook goes to f1
+					modify_squares_for_castled_rook(position, 0, 7, 5, move->is_piece_white);
 
-					modify_squares_for_castled_rook(a1_square, d1_square, move->is_piece_white);
+				} else if (move->target_rank == 0 && move->target_file == 2) { // white queenside castles, a1 rook goes to d1
+					modify_squares_for_castled_rook(position, 0, 0, 3, move->is_piece_white);
 				}
 			}
 
 			// the moving side's king loses castling rights, regardless of the type of king move made here
-			position->white_can_castle_kingside = false;
-			position->white_can_castle_queenside = false;
+			position->castling_rights &= ~(CASTLE_WHITE_KINGSIDE | CASTLE_WHITE_QUEENSIDE);
 		} else {
-			position->black_king_rank = move->target_rank;
-			position->black_king_file = move->target_file;
-
 			// if king is moving from it's starting square of e8
 			if (move->source_rank == 7 && move->source_file == 4) {
-				if (move->target_rank == 7 && move->target_file == 6) { // white kingside castles
-					struct square *h8_square = &position->squares[7][7];
-					struct square *f8_square = &position->squares[7][5];
-
-					modify_squares_for_castled_rook(h8_square, f8_square, move->is_piece_white);
-
-				} else if (move->target_rank == 7 && move->target_file == 2) { // white queenside castles
-					struct square *a8_square = &position->squares[7][0];
-					struct square *d8_square = &position->squares[7][3];
+				if (move->target_rank == 7 && move->target_file == 6) { // black kingside castles, h8 rook goes to f8
+					modify_squares_for_castled_rook(position, 7, 7, 5, move->is_piece_white);
 
-					modify_squares_for_castled_rook(a8_square, d8_square, move->is_piece_white);
+				} else if (move->target_rank == 7 && move->target_file == 2) { // black queenside castles, a8 rook goes to d8
+					modify_squares_for_castled_rook(position, 7, 0, 3, move->is_piece_white);
 				}
 			}
 
 			// the moving side's king loses castling rights, regardless of the type of king move made here
-			position->black_can_castle_kingside = false;
-			position->black_can_castle_queenside = false;
+			position->castling_rights &= ~(CASTLE_BLACK_KINGSIDE | CASTLE_BLACK_QUEENSIDE);
 		}
 
-	} else if (move->piece_type == PIECE_TYPE_ROOK) {
-
-		// a rook move that originates from the rook's original square (i.e. a1, h1, a8, h8)
-		// causes the appropriate castling rights to be revoked
-		if (move->source_rank == 0) {
-			if (move->source_file == 0)
-				position->white_can_castle_queenside = false;
-			else if (move->source_file == 7)
-				position->white_can_castle_kingside = false;
-
-		} else if (move->source_rank == 7) {
-			if (move->source_file == 0)
-				position->black_can_castle_queenside = false;
-			else if (move->source_file == 7)
-				position->black_can_castle_kingside = false;
-		}
-		
-	} 
-	
-	struct square *source_square = &position->squares[move->source_rank][move->source_file];
-	struct square *target_square = &position->squares[move->target_rank][move->target_file];
+	}
+
+	// a rook leaving its original square (i.e. a1, h1, a8, h8), or getting captured on it, revokes the appropriate castling rights
+	revoke_castling_rights_for_corner(position, move->source_rank, move->source_file);
+	revoke_castling_rights_for_corner(position, move->target_rank, move->target_file);
 	
 	if (move->is_capture) {
 		if (move->piece_type == PIECE_TYPE_PAWN && move->is_en_passant) {
-			fprintf(stderr, "en passant move is %s\n", move_str(move));
-			struct square *en_passanted_square = &position->squares[move->target_rank-1][move->target_file];
-			assert(en_passanted_square->has_piece);
-			assert(en_passanted_square->piece_type == PIECE_TYPE_PAWN);
-			en_passanted_square->has_piece = false;
+			// the captured pawn sits right behind the target square, from the capturing pawn's point of view
+			int en_passanted_rank = move->is_piece_white ? move->target_rank - 1 : move->target_rank + 1;
+			assert(get_square(position, en_passanted_rank, move->target_file).has_piece);
+			assert(get_square(position, en_passanted_rank, move->target_file).piece_type == PIECE_TYPE_PAWN);
+			remove_piece_from_square(position, en_passanted_rank, move->target_file);
 		} else {
-			assert(target_square->has_piece);
+			assert(get_square(position, move->target_rank, move->target_file).has_piece);
+			assert(get_square(position, move->target_rank, move->target_file).piece_type == move->captured_piece_type);
 		}
 	}
 
-	source_square->has_piece = false;
-
-	target_square->has_piece = true;
-	target_square->is_piece_white = move->is_piece_white;
+	remove_piece_from_square(position, move->source_rank, move->source_file);
 
 	if (move->is_promotion) {
-		target_square->piece_type = move->piece_type_promoted_to;
+		put_piece_on_square(position, move->target_rank, move->target_file, move->piece_type_promoted_to, move->is_piece_white);
 	} else {
-		target_square->piece_type = move->piece_type;
+		put_piece_on_square(position, move->target_rank, move->target_file, move->piece_type, move->is_piece_white);
 	}
 
 	// all previous en passant possibilities are gone after a move is made, there can only be one possibility on the next move
-	// that's only if the current move is a pawn move 2 squares forward
-	memset(position->can_en_passant, false, 8 * sizeof(position->can_en_passant[0])); 
-	if (move->piece_type == PIECE_TYPE_PAWN) {
-		if (int_difference(move->source_rank, move->target_rank) == 2) {
-			//fprintf(stderr, "setting file %d can_en_passant to true\n", move->target_file);
-			position->can_en_passant[move->target_file] = true;
+	// that's only if the current move is a pawn move 2 squares forward, next to an opposing pawn
+	if (move->piece_type == PIECE_TYPE_PAWN && int_difference(move->source_rank, move->target_rank) == 2 &&
+			can_pawn_be_captured_en_passant(position, SQUARE_INDEX(move->target_rank, move->target_file), move->is_piece_white)) {
+		position->en_passant_file = move->target_file;
+		position->hash ^= zobrist_en_passant_keys[move->target_file];
+	} else {
+		position->en_passant_file = NO_EN_PASSANT_FILE;
+	}
+
+	position->hash ^= zobrist_castling_keys[position->castling_rights];
+	position->hash ^= zobrist_black_to_move_key;
+
+	if (move->piece_type == PIECE_TYPE_PAWN || move->is_capture)
+		position->halfmove_clock = 0;
+	else
+		position->halfmove_clock++;
+
+	if (!move->is_piece_white)
+		position->fullmove_number++;
+
+#ifdef CHESS_VERIFY_HASH
+	if (position->hash != position_hash(position, !move->is_piece_white)) {
+		char move_str_buf[MOVE_STR_BUF_SIZE];
+		char position_str_buf[POSITION_STR_BUF_SIZE];
+		fprintf(stderr, "make_move: incremental hash %016" PRIx64 " doesn't match the recomputed hash %016" PRIx64 " after %s\n%s\n",
+			position->hash, position_hash(position, !move->is_piece_white), move_str(move, move_str_buf), position_str(position, position_str_buf));
+		exit(1);
+	}
+#endif
+}
+
+// takes back a move made by make_move, restoring position in place to exactly what it was before the move
+// undo must be the record filled in when the move was made, moves must be unmade in the reverse order they were made
+void unmake_move(struct position *position, const struct move *move, const struct undo_info *undo) {
+	assert(get_square(position, move->target_rank, move->target_file).has_piece);
+
+	// the moved piece goes back to its source square, as a pawn again if it promoted
+	remove_piece_from_square(position, move->target_rank, move->target_file);
+	put_piece_on_square(position, move->source_rank, move->source_file, move->piece_type, move->is_piece_white);
+
+	if (undo->has_captured_piece) {
+		if (move->piece_type == PIECE_TYPE_PAWN && move->is_en_passant) {
+			int en_passanted_rank = move->is_piece_white ? move->target_rank - 1 : move->target_rank + 1;
+			put_piece_on_square(position, en_passanted_rank, move->target_file, PIECE_TYPE_PAWN, !move->is_piece_white);
+		} else {
+			put_piece_on_square(position, move->target_rank, move->target_file, undo->captured_piece_type, !move->is_piece_white);
+		}
+	}
+
+	if (move->piece_type == PIECE_TYPE_KING) {
+		// a king moving 2 files is a castle, the rook goes back to its corner
+		if (move->target_file - move->source_file == 2) {
+			modify_squares_for_castled_rook(position, move->source_rank, 5, 7, move->is_piece_white);
+		} else if (move->target_file - move->source_file == -2) {
+			modify_squares_for_castled_rook(position, move->source_rank, 3, 0, move->is_piece_white);
 		}
 	}
+
+	position->castling_rights = undo->castling_rights;
+	position->en_passant_file = undo->en_passant_file;
+	position->hash = undo->hash;
+	position->halfmove_clock = undo->halfmove_clock;
+	if (!move->is_piece_white)
+		position->fullmove_number--;
 }
 
-void apply_move_to_game_state(struct game_state *game_state, const struct move *the_move) {
-	struct position *new_position = &game_state->positions[game_state->n_positions];
-	game_state->n_positions++;
-	
-	*new_position = *game_state->current_position;
+// applies move to position without keeping anything around to take it back with
+void apply_move_to_position(struct position *position, const struct move *move) {
+	struct undo_info undo;
+	make_move(position, move, &undo);
+}
+
+packed_move pack_move(const struct move *move) {
+	int flags = MOVE_FLAG_NONE;
+	if (move->is_promotion)
+		flags = MOVE_FLAG_PROMOTION | (move->piece_type_promoted_to - PIECE_TYPE_KNIGHT);
+	else if (move->is_en_passant)
+		flags = MOVE_FLAG_EN_PASSANT;
+	else if (move->piece_type == PIECE_TYPE_KING && int_difference(move->source_file, move->target_file) == 2)
+		flags = MOVE_FLAG_CASTLE;
+
+	return PACKED_MOVE(SQUARE_INDEX(move->source_rank, move->source_file), SQUARE_INDEX(move->target_rank, move->target_file), flags);
+}
+
+void unpack_move(const struct position *position, packed_move packed, struct move *into) {
+	int source_square = PACKED_MOVE_SOURCE(packed);
+	int target_square = PACKED_MOVE_TARGET(packed);
+	int flags = PACKED_MOVE_FLAGS(packed);
+
+	struct square source = get_square(position, SQUARE_RANK(source_square), SQUARE_FILE(source_square));
+	struct square target = get_square(position, SQUARE_RANK(target_square), SQUARE_FILE(target_square));
+	if (!source.has_piece) {
+		fprintf(stderr, "unpack_move: packed move %04x has no piece on its source square\n", packed);
+		exit(1);
+	}
+
+	memset(into, 0, sizeof(*into));
+	into->piece_type = source.piece_type;
+	into->is_piece_white = source.is_piece_white;
+	into->source_rank = SQUARE_RANK(source_square);
+	into->source_file = SQUARE_FILE(source_square);
+	into->target_rank = SQUARE_RANK(target_square);
+	into->target_file = SQUARE_FILE(target_square);
+
+	if (flags == MOVE_FLAG_EN_PASSANT) {
+		into->is_capture = true;
+		into->captured_piece_type = PIECE_TYPE_PAWN;
+		into->is_en_passant = true;
+	} else if (target.has_piece) {
+		into->is_capture = true;
+		into->captured_piece_type = target.piece_type;
+	}
+
+	if (flags & MOVE_FLAG_PROMOTION) {
+		into->is_promotion = true;
+		into->piece_type_promoted_to = PIECE_TYPE_KNIGHT + (flags & 3);
+	}
+}
+
+static void *resize_game_state_array(void *array, int n_elements, size_t element_size) {
+	void *resized = realloc(array, n_elements * element_size);
+	if (resized == NULL) {
+		fprintf(stderr, "out of memory growing a game's history to %d elements\n", n_elements);
+		exit(1);
+	}
+	return resized;
+}
+
+void init_game_state(struct game_state *game_state, const char *fen) {
+	load_fen_to_position(fen, &game_state->current_position);
+	game_state->white_to_move = is_white_to_move_in_fen(fen);
+	game_state->result = GAME_ONGOING;
+
+	game_state->plies_capacity = 256;
+	game_state->moves = resize_game_state_array(NULL, game_state->plies_capacity, sizeof(game_state->moves[0]));
+	game_state->hash_history = resize_game_state_array(NULL, game_state->plies_capacity, sizeof(game_state->hash_history[0]));
+	game_state->n_moves = 0;
+	game_state->hash_history[0] = game_state->current_position.hash;
+
+	game_state->checkpoints_capacity = 16;
+	game_state->checkpoints = resize_game_state_array(NULL, game_state->checkpoints_capacity, sizeof(game_state->checkpoints[0]));
+	game_state->checkpoints[0] = game_state->current_position;
+	game_state->n_checkpoints = 1;
+}
+
+void free_game_state(struct game_state *game_state) {
+	free(game_state->moves);
+	free(game_state->hash_history);
+	free(game_state->checkpoints);
+	game_state->moves = NULL;
+	game_state->hash_history = NULL;
+	game_state->checkpoints = NULL;
+}
+
+// records a move played on the game's current position, which is already updated, in the history
+static void record_move_in_game_history(struct game_state *game_state, const struct move *move) {
+	// the move takes a slot in moves, the position it leads to one in hash_history
+	if (game_state->n_moves + 2 > game_state->plies_capacity) {
+		game_state->plies_capacity *= 2;
+		game_state->moves = resize_game_state_array(game_state->moves, game_state->plies_capacity, sizeof(game_state->moves[0]));
+		game_state->hash_history = resize_game_state_array(game_state->hash_history, game_state->plies_capacity, sizeof(game_state->hash_history[0]));
+	}
+
+	game_state->moves[game_state->n_moves] = pack_move(move);
+	game_state->n_moves++;
+	game_state->hash_history[game_state->n_moves] = game_state->current_position.hash;
+
+	if (game_state->n_moves % GAME_CHECKPOINT_INTERVAL == 0) {
+		if (game_state->n_checkpoints == game_state->checkpoints_capacity) {
+			game_state->checkpoints_capacity *= 2;
+			game_state->checkpoints = resize_game_state_array(game_state->checkpoints, game_state->checkpoints_capacity, sizeof(game_state->checkpoints[0]));
+		}
+		game_state->checkpoints[game_state->n_checkpoints] = game_state->current_position;
+		game_state->n_checkpoints++;
+	}
+}
+
+void get_game_position_at_ply(const struct game_state *game_state, int ply, struct position *into) {
+	assert(ply >= 0 && ply <= game_state->n_moves);
+
+	if (ply == game_state->n_moves) {
+		*into = game_state->current_position;
+		return;
+	}
+
+	int checkpoint_idx = ply / GAME_CHECKPOINT_INTERVAL;
+	*into = game_state->checkpoints[checkpoint_idx];
+
+	for (int replayed_ply = checkpoint_idx * GAME_CHECKPOINT_INTERVAL; replayed_ply < ply; replayed_ply++) {
+		struct move move;
+		unpack_move(into, game_state->moves[replayed_ply], &move);
+		apply_move_to_position(into, &move);
+	}
+}
+
+void get_game_move_at_ply(const struct game_state *game_state, int ply, struct move *into) {
+	assert(ply >= 0 && ply < game_state->n_moves);
+
+	struct position position;
+	get_game_position_at_ply(game_state, ply, &position);
+	unpack_move(&position, game_state->moves[ply], into);
+	annotate_move(&position, into);
+}
+
+void apply_move_to_game_state(struct game_state *game_state, const struct move *move_to_apply) {
+	// the game's result needs the check/mate flags, the move may have come from lazy generation without them
+	// one look at the opponent's replies gives both them and whether the move stalemates
+	struct move annotated_move = *move_to_apply;
+	int move_result = is_move_check_or_mate(&game_state->current_position, &annotated_move);
+	annotated_move.is_check = move_result == MOVE_IS_CHECK;
+	annotated_move.is_mate = move_result == MOVE_IS_MATE;
+	const struct move *the_move = &annotated_move;
+
+	struct position *new_position = &game_state->current_position;
 	
 	apply_move_to_position(new_position, the_move);
+
+	record_move_in_game_history(game_state, the_move);
 	
+	// a mate on the 100th ply of the fifty move rule still counts, hence mate and stalemate are checked first
 	if (the_move->is_mate) {
 		if (the_move->is_piece_white)
 			game_state->result = WHITE_WON;
 		else
 			game_state->result = BLACK_WON;
+	} else if (move_result == MOVE_IS_STALEMATE) {
+		game_state->result = DRAW_BY_STALEMATE;
+	} else if (count_repetitions_of_last_position(game_state) >= 3) {
+		game_state->result = DRAW_BY_REPETITION;
+	} else if (new_position->halfmove_clock >= 100) {
+		game_state->result = DRAW_BY_FIFTY_MOVE_RULE;
 	}
-	game_state->current_position = new_position;
-	
-	game_state->moves[game_state->n_moves] = *the_move;
-	game_state->n_moves++;
 	
 	game_state->white_to_move = !the_move->is_piece_white;
 	
-	fprintf(stderr, "%s move: %s\n", the_move->is_piece_white ? "white's" : "black's", move_str(the_move));
+	char move_str_buf[MOVE_STR_BUF_SIZE];
+	fprintf(stderr, "%s move: %s\n", the_move->is_piece_white ? "white's" : "black's", move_str(the_move, move_str_buf));
 }
 
+int count_repetitions_of_last_position(const struct game_state *game_state) {
+	int last_idx = game_state->n_moves;
+	uint64_t last_hash = game_state->hash_history[last_idx];
 
+	// the oldest position that can still be the same as the last one, i.e. the one right after the last capture or pawn move
+	int oldest_idx = last_idx - game_state->current_position.halfmove_clock;
+	if (oldest_idx < 0)
+		oldest_idx = 0;
 
-static void undo_move_from_position(struct position *position, const struct move *move) {
-	n_saved_position_states--;
-
-	if (n_saved_position_states < 0) {
-		fprintf(stderr, "n_saved_states is < 0 during undo_move_from_position\n");
-		exit(1);
-	}
-	*position = saved_position_states[n_saved_position_states];
-}
-
-// returns whether the square [rank][file] is directly attacked by a piece of a color (white if is_color_white, otherwise black);
-// from the provided direction
-// the rank_dir and file_dir should both be in [-1, 1], otherwise the result doesn't really make sense
-bool is_square_attacked_from_direction_by_color(const struct position *position, bool is_color_white, int rank, int file, int rank_dir, int file_dir) {
-	#define DIAGONAL_DIRECTION 0
-	#define STRAIGHT_DIRECTION 1
-
-	// are we looking along a diagonal or a file/rank?
-	int direction_we_are_checking;
-	if (rank_dir == 0) {
-		assert(file_dir != 0); // we should not call this function with rank_dir AND file_dir == 0, it'll spin forever
-		direction_we_are_checking = STRAIGHT_DIRECTION;
-	} else if (file_dir == 0) {
-		assert(rank_dir != 0); // we should not call this function with rank_dir AND file_dir == 0, it'll spin forever
-		direction_we_are_checking = STRAIGHT_DIRECTION;
-	} else {
-		direction_we_are_checking = DIAGONAL_DIRECTION;
+	// the same side has to be to move, so only every other position can match
+	int n_repetitions = 1;
+	for (int i = last_idx - 2; i >= oldest_idx; i -= 2) {
+		if (game_state->hash_history[i] == last_hash)
+			n_repetitions++;
 	}
 
-	// these are the coordinates of the square we are checking right now in the rank and file directions
-	int target_rank = rank + rank_dir;
-	int target_file = file + file_dir;
+	return n_repetitions;
+}
 
-	int steps_in_direction = 1;
 
-	// loop while we are within bounds of the position, if we exit bounds, then the square is not under attack from the direction
-	while (target_rank >= 0 && target_rank <= 7 && target_file >= 0 && target_file <= 7) {		
-		struct square target_square = position->squares[target_rank][target_file];
 
-		if (target_square.has_piece) {
-			bool is_target_square_piece_white = target_square.is_piece_white;
-			
-			if (is_target_square_piece_white != is_color_white) {
-				// we've hit a piece of the opposite color in this direction
-				// therefore the square is not attacked from this direction
-				return false;
-			
-			} else if (target_square.piece_type == PIECE_TYPE_KING) {
-				// if we've only made one step in the direction, and a king of the color is there, then the square is attacked
-				if (steps_in_direction == 1) {
-					return true;
-				}
+// returns the set of pieces, of both colors, that attack square given the occupied squares
+// occupied can differ from the position's actual occupancy, e.g. to look through a piece that is about to move
+bitboard attackers_to_square(const struct position *position, int square, bitboard occupied) {
+	const struct bitboard_position *bitboards = &position->bitboards;
 
-			} else if (target_square.piece_type == PIECE_TYPE_PAWN) {
-				// if we've only made one step in the direction and checking diagonally
-				// and a pawn is on the next rank, then the pawn is attacking that square
-				if (steps_in_direction == 1 && direction_we_are_checking == DIAGONAL_DIRECTION) {
-					if (is_target_square_piece_white) {
-						if (rank_dir == -1)
-							return true;
-					} else {
-						if (rank_dir == 1)
-							return true;
-					}
-				}
+	bitboard diagonal_sliders = bitboards->pieces[COLOR_WHITE][PIECE_TYPE_BISHOP] | bitboards->pieces[COLOR_WHITE][PIECE_TYPE_QUEEN] |
+		bitboards->pieces[COLOR_BLACK][PIECE_TYPE_BISHOP] | bitboards->pieces[COLOR_BLACK][PIECE_TYPE_QUEEN];
+	bitboard straight_sliders = bitboards->pieces[COLOR_WHITE][PIECE_TYPE_ROOK] | bitboards->pieces[COLOR_WHITE][PIECE_TYPE_QUEEN] |
+		bitboards->pieces[COLOR_BLACK][PIECE_TYPE_ROOK] | bitboards->pieces[COLOR_BLACK][PIECE_TYPE_QUEEN];
 
-			} else if (target_square.piece_type == PIECE_TYPE_QUEEN) {
-				// the piece in this direction is a queen, which is checking the king regardless of whether our direction is diagonal or straight down a rank or file
-				return true;
-		
-			} else if (target_square.piece_type == PIECE_TYPE_ROOK) {
-				if (direction_we_are_checking == STRAIGHT_DIRECTION)
-					return true;
-				else
-					return false;
+	// a pawn attacks the square if a pawn of the other color on the square would attack the pawn
+	return (pawn_attacks[COLOR_BLACK][square] & bitboards->pieces[COLOR_WHITE][PIECE_TYPE_PAWN]) |
+		(pawn_attacks[COLOR_WHITE][square] & bitboards->pieces[COLOR_BLACK][PIECE_TYPE_PAWN]) |
+		(knight_attacks[square] & (bitboards->pieces[COLOR_WHITE][PIECE_TYPE_KNIGHT] | bitboards->pieces[COLOR_BLACK][PIECE_TYPE_KNIGHT])) |
+		(king_attacks[square] & (bitboards->pieces[COLOR_WHITE][PIECE_TYPE_KING] | bitboards->pieces[COLOR_BLACK][PIECE_TYPE_KING])) |
+		(bishop_attacks(square, occupied) & diagonal_sliders) |
+		(rook_attacks(square, occupied) & straight_sliders);
+}
 
-			} else if (target_square.piece_type == PIECE_TYPE_BISHOP) {
-				if (direction_we_are_checking == DIAGONAL_DIRECTION)
-					return true;
-				else
-					return false;
-			}
-		}
-		target_rank += rank_dir; target_file += file_dir;
-		steps_in_direction++;
-	}
+// the color dependent parts of move generation below are written once as FORCE_INLINE functions taking the color as a
+// const bool, and are only ever called with a literal true or false, so each one is compiled once per color with its
+// color tests (pawn direction, promotion, en passant and castling ranks) folded into constants
+#if defined(_MSC_VER)
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
 
-	// we exited the loop without hitting a piece of any color, we are not in attack from this direction
-	return false;
-}
+// returns whether square is attacked by a piece of color given the occupied squares, stops at the first kind of attacker found
+static FORCE_INLINE bool is_square_attacked_by_color(const struct position *position, int square, bitboard occupied, const int color) {
+	const struct bitboard_position *bitboards = &position->bitboards;
 
-// returns whether square [rank][file] is attacked by a piece of a provided color
-bool is_square_attacked_by_piece_of_color(const struct position *position, int rank, int file, bool is_color_white) {
-	assert(rank >= 0);
-	assert(rank <= 7);
-	assert(file >= 0);
-	assert(rank <= 7);
+	// a pawn of the color attacks the square if a pawn of the other color on the square would attack the pawn
+	if (pawn_attacks[!color][square] & bitboards->pieces[color][PIECE_TYPE_PAWN])
+		return true;
 
-	// diagonal checks for bishop or queen attack, also includes attacks by pawn & king, which can only apply after 1 step in the direction
-	{
-		// -1, -1 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, -1, -1))
-			return true;
+	if (knight_attacks[square] & bitboards->pieces[color][PIECE_TYPE_KNIGHT])
+		return true;
 
-		// -1, 1
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, -1, 1))
-			return true;
+	if (king_attacks[square] & bitboards->pieces[color][PIECE_TYPE_KING])
+		return true;
 
-		// 1, -1 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, 1, -1))
-			return true;
+	// sliders attack the square if the square, acting as the same kind of slider, can see them
+	bitboard diagonal_attackers = bitboards->pieces[color][PIECE_TYPE_BISHOP] | bitboards->pieces[color][PIECE_TYPE_QUEEN];
+	if (bishop_attacks(square, occupied) & diagonal_attackers)
+		return true;
 
-		// 1, 1 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, 1, 1))
-			return true;
+	bitboard straight_attackers = bitboards->pieces[color][PIECE_TYPE_ROOK] | bitboards->pieces[color][PIECE_TYPE_QUEEN];
+	if (rook_attacks(square, occupied) & straight_attackers)
+		return true;
+
+	return false;
+}
+
+// returns the square of the least valuable piece in attackers, and its type in *attacker_type, attackers must not be empty
+static int least_valuable_attacker(const struct position *position, bitboard attackers, piece_type *attacker_type) {
+	for (int type = PIECE_TYPE_PAWN; type <= PIECE_TYPE_KING; type++) {
+		bitboard of_type = attackers & (position->bitboards.pieces[COLOR_WHITE][type] | position->bitboards.pieces[COLOR_BLACK][type]);
+		if (of_type) {
+			*attacker_type = type;
+			return bitboard_lsb(of_type);
+		}
 	}
 
-	// attacks along a rank or file by either a queen or rook, also includes attacks by a king, which can only apply after 1 step in the direction
-	{
-		// 1, 0 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, 1, 0))
-			return true;
+	assert(false);
+	return -1;
+}
 
-		// -1, 0 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, -1, 0))
-			return true;
+int see(const struct position *position, const struct move *move) {
+	const struct bitboard_position *bitboards = &position->bitboards;
+	int source_square = SQUARE_INDEX(move->source_rank, move->source_file);
+	int target_square = SQUARE_INDEX(move->target_rank, move->target_file);
 
-		// 0, 1 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, 0, 1))
-			return true;
+	bitboard diagonal_sliders = bitboards->pieces[COLOR_WHITE][PIECE_TYPE_BISHOP] | bitboards->pieces[COLOR_WHITE][PIECE_TYPE_QUEEN] |
+		bitboards->pieces[COLOR_BLACK][PIECE_TYPE_BISHOP] | bitboards->pieces[COLOR_BLACK][PIECE_TYPE_QUEEN];
+	bitboard straight_sliders = bitboards->pieces[COLOR_WHITE][PIECE_TYPE_ROOK] | bitboards->pieces[COLOR_WHITE][PIECE_TYPE_QUEEN] |
+		bitboards->pieces[COLOR_BLACK][PIECE_TYPE_ROOK] | bitboards->pieces[COLOR_BLACK][PIECE_TYPE_QUEEN];
 
-		// 0, -1 direction
-		if (is_square_attacked_from_direction_by_color(position, is_color_white, rank, file, 0, -1))
-			return true;
+	// gain[i] is the material won by the side making the i-th capture on the target square, if the exchange stopped right after it
+	// 32 is more captures than there are pieces
+	int gain[32];
+	int n_captures = 0;
+
+	gain[0] = move->is_capture ? piece_values[move->captured_piece_type] : 0;
+	piece_type piece_on_target = move->piece_type;
+	if (move->is_promotion) {
+		gain[0] += piece_values[move->piece_type_promoted_to] - piece_values[PIECE_TYPE_PAWN];
+		piece_on_target = move->piece_type_promoted_to;
 	}
 
-	// attacks by a knight
-	{
-		for (int i = 0; i < 8; i++) {
-			int knight_rank = rank + knight_move_rank_offsets[i];
-			int knight_file = file + knight_move_file_offsets[i];
-	
-			if (knight_rank < 0 || knight_rank > 7 || knight_file < 0 || knight_file > 7)
-				continue;
+	bitboard occupied = bitboards->occupied & ~SQUARE_BIT(source_square);
+	if (move->is_en_passant)
+		occupied &= ~SQUARE_BIT(SQUARE_INDEX(move->source_rank, move->target_file));
+
+	// a piece leaving the board can uncover a slider behind it, so attackers are looked up again with every capture
+	bitboard attackers = attackers_to_square(position, target_square, occupied) & occupied;
+	int side_to_capture = !COLOR_INDEX(move->is_piece_white);
 
-			struct square the_square = position->squares[knight_rank][knight_file];
-			
-			if (the_square.has_piece && the_square.is_piece_white == is_color_white && the_square.piece_type == PIECE_TYPE_KNIGHT)
-				return true;
+	for (;;) {
+		bitboard own_attackers = attackers & bitboards->occupied_by_color[side_to_capture];
+		if (!own_attackers)
+			break;
+
+		piece_type attacker_type;
+		int attacker_square = least_valuable_attacker(position, own_attackers, &attacker_type);
+		bitboard occupied_after = occupied & ~SQUARE_BIT(attacker_square);
+
+		// the king can only take last, when no opposing piece, including one it uncovers, defends the square
+		if (attacker_type == PIECE_TYPE_KING) {
+			bitboard defenders = attackers_to_square(position, target_square, occupied_after) & occupied_after & bitboards->occupied_by_color[!side_to_capture];
+			if (defenders)
+				break;
 		}
+
+		n_captures++;
+		gain[n_captures] = piece_values[piece_on_target] - gain[n_captures - 1];
+		piece_on_target = attacker_type;   // a pawn promoting while capturing back is valued as a pawn
+
+		occupied = occupied_after;
+		attackers |= (bishop_attacks(target_square, occupied) & diagonal_sliders) | (rook_attacks(target_square, occupied) & straight_sliders);
+		attackers &= occupied;
+		side_to_capture = !side_to_capture;
 	}
 
-	return false;
+	// each side only captures back if that doesn't lose more than stopping, working backwards from the last capture
+	while (n_captures > 0) {
+		int stop = -gain[n_captures - 1];
+		if (gain[n_captures] > stop)
+			stop = gain[n_captures];
+		gain[n_captures - 1] = -stop;
+		n_captures--;
+	}
+
+	return gain[0];
+}
+
+// returns whether square [rank][file] is attacked by a piece of a provided color
+bool is_square_attacked_by_piece_of_color(const struct position *position, int rank, int file, bool is_color_white) {
+	assert(rank >= 0);
+	assert(rank <= 7);
+	assert(file >= 0);
+	assert(file <= 7);
+
+	if (is_color_white)
+		return is_square_attacked_by_color(position, SQUARE_INDEX(rank, file), position->bitboards.occupied, COLOR_WHITE);
+	return is_square_attacked_by_color(position, SQUARE_INDEX(rank, file), position->bitboards.occupied, COLOR_BLACK);
 }
 
 // returns whether the king located at king_rank, king_file is in check on the provided position
 bool is_king_on_square_in_check(const struct position *position, int king_rank, int king_file) {
-	if (!position->squares[king_rank][king_file].has_piece) {
+	if (!get_square(position, king_rank, king_file).has_piece) {
 		fprintf(stderr, "is_king_on_square_in_check target square %d %d does not have a piece at all!\n", king_rank, king_file);
-		fprintf(stderr, "%s\n", position_str(position));
+		char position_str_buf[POSITION_STR_BUF_SIZE];
+		fprintf(stderr, "%s\n", position_str(position, position_str_buf));
 		exit(1);
 	}
-	if (position->squares[king_rank][king_file].piece_type != PIECE_TYPE_KING) {
-		fprintf(stderr, "is_king_on_square_in_check target square %d %d does not have a king, it has piece %d!\n", king_rank, king_file, position->squares[king_rank][king_file].piece_type);
-		fprintf(stderr, "%s\n", position_str(position));
+	if (get_square(position, king_rank, king_file).piece_type != PIECE_TYPE_KING) {
+		fprintf(stderr, "is_king_on_square_in_check target square %d %d does not have a king, it has piece %d!\n", king_rank, king_file, get_square(position, king_rank, king_file).piece_type);
+		char position_str_buf[POSITION_STR_BUF_SIZE];
+		fprintf(stderr, "%s\n", position_str(position, position_str_buf));
 		exit(1);
 	}
-	
-	bool is_king_white = position->squares[king_rank][king_file].is_piece_white;
+
+	bool is_king_white = get_square(position, king_rank, king_file).is_piece_white;
 
 	// just check if the king's square is attacked by a piece of the opposite color
 	return is_square_attacked_by_piece_of_color(position, king_rank, king_file, !is_king_white);
 }
 
+// copy-make legality test, applies the move and checks whether the mover's king is left in check
+// the generators below no longer need this, they only produce legal moves, it's kept as a reference to verify them against
 bool is_move_legal(struct position *position, struct move *move) {
-	apply_move_to_position(position, move);
+	struct undo_info undo;
+	make_move(position, move, &undo);
 
 	int king_rank, king_file;
 	get_king_position(position, move->is_piece_white, &king_rank, &king_file);
 
 	// a move is illegal if it puts the mover's side's king in check
 	bool is_illegal = is_king_on_square_in_check(position, king_rank, king_file);
-	
-	undo_move_from_position(position, move);
+
+	unmake_move(position, move, &undo);
 
 	return !is_illegal;
 }
 
+// sets which kinds of moves the generators produce according to the MOVE_GEN_NOISY_ONLY/QUIET_ONLY bits of gen_flags
+// can be called again on an initialized gen, the checks and pins it holds don't depend on it
+static void set_move_gen_flags(const struct position *position, struct move_gen *gen, int gen_flags) {
+	const struct bitboard_position *bitboards = &position->bitboards;
+	assert((gen_flags & (MOVE_GEN_NOISY_ONLY | MOVE_GEN_QUIET_ONLY)) != (MOVE_GEN_NOISY_ONLY | MOVE_GEN_QUIET_ONLY));
+
+	gen->gen_flags = gen_flags;
+	gen->has_noisy = !(gen_flags & MOVE_GEN_QUIET_ONLY);
+	gen->has_quiet = !(gen_flags & MOVE_GEN_NOISY_ONLY);
+
+	if (gen->has_noisy && gen->has_quiet)
+		gen->target_filter = ~(bitboard)0;
+	else if (gen->has_noisy)
+		gen->target_filter = bitboards->occupied_by_color[!COLOR_INDEX(gen->is_color_white)];
+	else
+		gen->target_filter = ~bitboards->occupied;
+}
+
+static void init_move_gen(const struct position *position, bool is_color_white, int gen_flags, struct move_gen *gen) {
+	const struct bitboard_position *bitboards = &position->bitboards;
+	int color = COLOR_INDEX(is_color_white);
+	int opposing_color = !color;
+
+	int king_square = bitboard_lsb(bitboards->pieces[color][PIECE_TYPE_KING]);
+
+	gen->is_color_white = is_color_white;
+	set_move_gen_flags(position, gen, gen_flags);
+	gen->king_square = king_square;
+	gen->checkers = attackers_to_square(position, king_square, bitboards->occupied) & bitboards->occupied_by_color[opposing_color];
+
+	int n_checkers = bitboard_popcount(gen->checkers);
+	if (n_checkers == 0) {
+		gen->check_mask = ~(bitboard)0;
+	} else if (n_checkers == 1) {
+		int checker_square = bitboard_lsb(gen->checkers);
+		// squares_between is empty for knights and pawns, which can only be captured
+		gen->check_mask = gen->checkers | squares_between[king_square][checker_square];
+	} else {
+		// in double check only the king can move
+		gen->check_mask = 0;
+	}
+
+	// an opposing slider that would see the king on an empty board pins the piece between them, if that piece is the only one there and it's ours
+	bitboard snipers = (rook_attacks(king_square, 0) & (bitboards->pieces[opposing_color][PIECE_TYPE_ROOK] | bitboards->pieces[opposing_color][PIECE_TYPE_QUEEN])) |
+		(bishop_attacks(king_square, 0) & (bitboards->pieces[opposing_color][PIECE_TYPE_BISHOP] | bitboards->pieces[opposing_color][PIECE_TYPE_QUEEN]));
+
+	gen->pinned = 0;
+	while (snipers) {
+		int sniper_square = bitboard_pop_lsb(&snipers);
+		bitboard blockers = squares_between[king_square][sniper_square] & bitboards->occupied;
+
+		if (bitboard_popcount(blockers) == 1)
+			gen->pinned |= blockers & bitboards->occupied_by_color[color];
+	}
+}
+
+// the squares a non-king piece on square may move to without leaving its king in check
+// a pinned piece may only move along the line through its king and the pinner
+static bitboard legal_targets_for_piece(const struct move_gen *gen, int square) {
+	bitboard targets = gen->check_mask;
+	if (gen->pinned & SQUARE_BIT(square))
+		targets &= squares_line[gen->king_square][square];
+	return targets;
+}
+
+static bool is_target_allowed(bitboard allowed_targets, int rank, int file) {
+	return (allowed_targets & SQUARE_BIT(SQUARE_INDEX(rank, file))) != 0;
+}
+
+// en passant removes two pieces from the capturing pawn's rank at once, which the pin detection above doesn't cover
+// e.g. king on a5, our pawn on d5, their pawn on e5, their rook on h5, so it's tested directly on the resulting occupancy
+static bool is_en_passant_legal(const struct position *position, const struct move_gen *gen, int source_square, int target_square, int captured_square) {
+	const struct bitboard_position *bitboards = &position->bitboards;
+	int opposing_color = !COLOR_INDEX(gen->is_color_white);
+
+	bitboard occupied_after = (bitboards->occupied & ~SQUARE_BIT(source_square) & ~SQUARE_BIT(captured_square)) | SQUARE_BIT(target_square);
+	bitboard attackers = attackers_to_square(position, gen->king_square, occupied_after) & bitboards->occupied_by_color[opposing_color];
+
+	return (attackers & ~SQUARE_BIT(captured_square)) == 0;
+}
+
+// where the generators record the moves they find, at most one of the two lists is set
+// with neither set the generators only count the moves
+struct move_sink {
+	struct move *moves;
+	packed_move *packed_moves;
+};
+
 // does the following steps:
-// checks if the move is legal
-// if it is, checks if it the move is a check or mate
-// if *intop is not NULL, records the move there, increments *intop, and increments *n_moves
-void finalize_move_info_and_record_if_legal(struct position *position, struct move *move, struct move **intop, int *n_moves) {
-	struct move *into = *intop;
+// if the generation was asked to annotate checks, checks if the move is a check or mate
+// records the move into whichever list of the sink is set, advancing it
+// increments *n_moves regardless, the move must already be known to be legal
+static void finalize_move_info_and_record(struct position *position, const struct move_gen *gen, struct move *move, struct move_sink *sink, int *n_moves) {
+#ifdef CHESS_VERIFY_MOVE_GENERATION
+	if (!is_move_legal(position, move)) {
+		char move_str_buf[MOVE_STR_BUF_SIZE];
+		char position_str_buf[POSITION_STR_BUF_SIZE];
+		fprintf(stderr, "move generation produced illegal move %s\n%s\n", move_str(move, move_str_buf), position_str(position, position_str_buf));
+		exit(1);
+	}
+#endif
+
 	move->is_check = false;
 	move->is_mate = false;
-	if (is_move_legal(position, move)) {
-		if (into != NULL) {
-			int move_result = is_move_check_or_mate(position, move);
-			if (move_result == MOVE_IS_MATE) {
-				move->is_mate = true;
-			} else if (move_result == MOVE_IS_CHECK) {
-				move->is_check = true;
-			}
-			
-			*into = *move;
-			(*intop)++;
-		}
-		(*n_moves)++;
+	if (sink->moves != NULL) {
+		if (gen->gen_flags & MOVE_GEN_ANNOTATE_CHECKS)
+			annotate_move(position, move);
+
+		*sink->moves = *move;
+		sink->moves++;
+	} else if (sink->packed_moves != NULL) {
+		*sink->packed_moves = pack_move(move);
+		sink->packed_moves++;
 	}
+	(*n_moves)++;
 }
 
 
-int find_all_possible_pawn_moves(struct position *position, struct move **into, int rank, int file) {
+// generates the moves of the pawn on [rank][file], whose color must be is_pawn_white
+static FORCE_INLINE int find_all_possible_pawn_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file, const bool is_pawn_white) {
 	assert(rank >= 0 && rank <= 7);
 	assert(file >= 0 && file <= 7);
-	assert(position->squares[rank][file].has_piece);
-	assert(position->squares[rank][file].piece_type == PIECE_TYPE_PAWN);
-
-	bool is_pawn_white = position->squares[rank][file].is_piece_white;
+	assert(get_square(position, rank, file).has_piece);
+	assert(get_square(position, rank, file).piece_type == PIECE_TYPE_PAWN);
+	assert(get_square(position, rank, file).is_piece_white == is_pawn_white);
+
+	// everything that depends on the pawn's color, left and right are from the pawn's own point of view
+	const int forward = is_pawn_white ? 1 : -1;
+	const int left = is_pawn_white ? -1 : 1;
+	const int right = -left;
+	const int promotion_rank = is_pawn_white ? 7 : 0;
+	const int double_push_rank = is_pawn_white ? 1 : 6;
+	// en_passant_file only says which file the last double push happened on, the opposing pawn on that file is only the one
+	// that double pushed if it's on the capturing pawn's rank, i.e. the 5th rank from the capturing side's point of view
+	const int en_passant_rank = is_pawn_white ? 4 : 3;
+
+	bitboard allowed_targets = legal_targets_for_piece(gen, SQUARE_INDEX(rank, file));
 
 	// next_rank for a pawn move of 1 square forward
-	int next_rank;
-	if (is_pawn_white) {
-		next_rank = rank + 1;
-	} else {
-		next_rank = rank - 1;
-	}
+	int next_rank = rank + forward;
 	// a pawn cannot end up on the last rank without promotion, so the square in front of a pawn must not be out of bounds
 	assert(next_rank >= 0);
 	assert(next_rank <= 7);
-	
+
 	int n_moves = 0;
 
 	struct move next_move = {0};
@@ -436,43 +842,40 @@ int find_all_possible_pawn_moves(struct position *position, struct move **into,
 
 	// move forward one square logic
 	{
-		struct square square_in_front_of_pawn = position->squares[next_rank][file];
-		if (!square_in_front_of_pawn.has_piece) {
+		struct square square_in_front_of_pawn = get_square(position, next_rank, file);
+		// a push is a quiet move, unless it promotes
+		bool is_push_wanted = next_rank == promotion_rank ? gen->has_noisy : gen->has_quiet;
+		if (is_push_wanted && !square_in_front_of_pawn.has_piece && is_target_allowed(allowed_targets, next_rank, file)) {
 			next_move.target_rank = next_rank;
 			next_move.target_file = file;
 			next_move.is_capture = false;
 			next_move.is_en_passant = false;
 
 			// promotion case for pawn
-			if ((next_rank == 0) || (next_rank == 7)) {
+			if (next_rank == promotion_rank) {
 				next_move.is_promotion = true;
 
 				for (int i = 0; i < 4; i++) {
 					next_move.piece_type_promoted_to = possible_promotions[i];
 
-					finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+					finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 				}
 			} else { // forward move without promotion
 				next_move.is_promotion = false;
-				finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+				finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 			}
 
 		}
 	}
-	
+
 
 	// capture diagonally to the left
 	{
-		int left_file;
-		if (is_pawn_white)
-			left_file = file - 1;
-		else
-			left_file = file + 1;
-		
-		
-		if (left_file >= 0 && left_file <= 7) {
-			struct square target_square = position->squares[next_rank][left_file];
-		
+		int left_file = file + left;
+
+		if (gen->has_noisy && left_file >= 0 && left_file <= 7 && is_target_allowed(allowed_targets, next_rank, left_file)) {
+			struct square target_square = get_square(position, next_rank, left_file);
+
 			if (target_square.has_piece && (target_square.is_piece_white != is_pawn_white)) {
 				// we should never end up in situation where the target square has a king and the pawn can capture it
 				assert(target_square.piece_type != PIECE_TYPE_KING);
@@ -483,33 +886,29 @@ int find_all_possible_pawn_moves(struct position *position, struct move **into,
 				next_move.captured_piece_type = target_square.piece_type;
 				next_move.is_en_passant = false;
 
-				if ((next_rank == 0) || (next_rank == 7)) {
+				if (next_rank == promotion_rank) {
 					next_move.is_promotion = true;
 
 					for (int i = 0; i < 4; i++) {
 						next_move.piece_type_promoted_to = possible_promotions[i];
-						finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+						finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 					}
 
 				} else {
 					next_move.is_promotion = false;
-					finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-				}	
+					finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
+				}
 			}
 		}
 	}
 
 	// capture diagonally to the right
 	{
-		int right_file;
-		if (is_pawn_white)
-			right_file = file + 1;
-		else
-			right_file = file - 1;
+		int right_file = file + right;
+
+		if (gen->has_noisy && right_file >= 0 && right_file <= 7 && is_target_allowed(allowed_targets, next_rank, right_file)) {
+			struct square target_square = get_square(position, next_rank, right_file);
 
-		if (right_file >= 0 && right_file <= 7) {
-			struct square target_square = position->squares[next_rank][right_file];
-		
 			if (target_square.has_piece && (target_square.is_piece_white != is_pawn_white)) {
 				// we should never end up in situation where the target square has a king of the opposite color and the pawn can capture it
 				assert(target_square.piece_type != PIECE_TYPE_KING);
@@ -520,56 +919,51 @@ int find_all_possible_pawn_moves(struct position *position, struct move **into,
 				next_move.captured_piece_type = target_square.piece_type;
 				next_move.is_en_passant = false;
 
-				if ((next_rank == 0) || (next_rank == 7)) {
+				if (next_rank == promotion_rank) {
 					next_move.is_promotion = true;
 
 					for (int i = 0; i < 4; i++) {
 						next_move.piece_type_promoted_to = possible_promotions[i];
-						finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+						finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 					}
 
 				} else {
 					next_move.is_promotion = false;
-					finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-				}	
+					finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
+				}
 			}
 		}
 	}
 
 	// forward 2 squares logic
-	{
-		int target_rank = -1;
-		if (is_pawn_white && rank == 1) {
-			target_rank = rank + 2;
-		} else if (!is_pawn_white && rank == 6) {
-			target_rank = rank - 2;
-		}
+	if (gen->has_quiet && rank == double_push_rank) {
+		int target_rank = rank + 2 * forward;
 
-		if ((target_rank != -1) && !position->squares[target_rank][file].has_piece && !position->squares[next_rank][file].has_piece) {
+		if (!get_square(position, target_rank, file).has_piece && !get_square(position, next_rank, file).has_piece &&
+				is_target_allowed(allowed_targets, target_rank, file)) {
 			next_move.is_capture = false;
 			next_move.is_promotion = false;
 			next_move.target_rank = target_rank;
 			next_move.target_file = file;
 			next_move.is_en_passant = false;
 
-			finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+			finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 		}
-		
+
 	}
 
+	bool is_on_en_passant_rank = gen->has_noisy && rank == en_passant_rank;
+
 	// en passant to the left of the pawn
 	{
-		int left_file;
-		if (is_pawn_white)
-			left_file = file - 1;
-		else
-			left_file = file + 1;
-		
-		if (left_file >= 0 && left_file <= 7) {
-			
-			struct square target_square = position->squares[rank][left_file];
+		int left_file = file + left;
+
+		if (is_on_en_passant_rank && left_file >= 0 && left_file <= 7) {
+
+			struct square target_square = get_square(position, rank, left_file);
 
-			bool can_en_passant = target_square.has_piece && (target_square.is_piece_white != is_pawn_white) && (target_square.piece_type == PIECE_TYPE_PAWN) && position->can_en_passant[left_file];
+			bool can_en_passant = target_square.has_piece && (target_square.is_piece_white != is_pawn_white) && (target_square.piece_type == PIECE_TYPE_PAWN) && position->en_passant_file == left_file &&
+				is_en_passant_legal(position, gen, SQUARE_INDEX(rank, file), SQUARE_INDEX(next_rank, left_file), SQUARE_INDEX(rank, left_file));
 			if (can_en_passant) {
 				next_move.is_capture = true;
 				next_move.captured_piece_type = PIECE_TYPE_PAWN;
@@ -578,24 +972,21 @@ int find_all_possible_pawn_moves(struct position *position, struct move **into,
 				next_move.is_promotion = false;
 				next_move.is_en_passant = true;
 
-				finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+				finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 			}
 		}
 	}
 
 	// en passant to the right of the pawn
 	{
-		int right_file;
-		if (is_pawn_white)
-			right_file = file + 1;
-		else
-			right_file = file - 1;
-		
-		if (right_file >= 0 && right_file <= 7) {
-			
-			struct square target_square = position->squares[rank][right_file];
+		int right_file = file + right;
+
+		if (is_on_en_passant_rank && right_file >= 0 && right_file <= 7) {
+
+			struct square target_square = get_square(position, rank, right_file);
 
-			bool can_en_passant = target_square.has_piece && (target_square.is_piece_white != is_pawn_white) && (target_square.piece_type == PIECE_TYPE_PAWN) && position->can_en_passant[right_file];
+			bool can_en_passant = target_square.has_piece && (target_square.is_piece_white != is_pawn_white) && (target_square.piece_type == PIECE_TYPE_PAWN) && position->en_passant_file == right_file &&
+				is_en_passant_legal(position, gen, SQUARE_INDEX(rank, file), SQUARE_INDEX(next_rank, right_file), SQUARE_INDEX(rank, right_file));
 			if (can_en_passant) {
 				next_move.is_capture = true;
 				next_move.captured_piece_type = PIECE_TYPE_PAWN;
@@ -604,7 +995,7 @@ int find_all_possible_pawn_moves(struct position *position, struct move **into,
 				next_move.is_promotion = false;
 				next_move.is_en_passant = true;
 
-				finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+				finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 			}
 		}
 	}
@@ -614,211 +1005,181 @@ int find_all_possible_pawn_moves(struct position *position, struct move **into,
 
 
 
-int find_all_possible_knight_moves(struct position *position, struct move **into, int rank, int file) {
+int find_all_possible_knight_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
 	assert(rank >= 0 && rank <= 7);
-	assert(file >= 0 && rank <= 7);
-	assert(position->squares[rank][file].has_piece);
-	assert(position->squares[rank][file].piece_type == PIECE_TYPE_KNIGHT);
+	assert(file >= 0 && file <= 7);
+	assert(get_square(position, rank, file).has_piece);
+	assert(get_square(position, rank, file).piece_type == PIECE_TYPE_KNIGHT);
 
-	bool is_knight_white = position->squares[rank][file].is_piece_white;
+	bool is_knight_white = get_square(position, rank, file).is_piece_white;
 
 	struct move next_move = {0};
 	next_move.piece_type = PIECE_TYPE_KNIGHT;
 	next_move.is_piece_white = is_knight_white;
 	next_move.source_rank = rank;
 	next_move.source_file = file;
-	
+
 	int n_moves = 0;
-	
-	for (int i = 0; i < 8; i++) {
-		int target_rank = rank + knight_move_rank_offsets[i];
-		int target_file = file + knight_move_file_offsets[i];
-	
-		if (target_rank >= 0 && target_rank <= 7 && target_file >= 0 && target_file <= 7) {
-		
-			struct square target_square = position->squares[target_rank][target_file];
-			
-			next_move.target_rank = target_rank;
-			next_move.target_file = target_file;
-			
-			if (target_square.has_piece) {
-				if (target_square.is_piece_white == is_knight_white) {
-					continue;
-				}
-		
-				// we should never end up in situation where the target square has a king and the knight can capture it
-				assert(target_square.piece_type != PIECE_TYPE_KING);
-				
-				next_move.is_capture = true;
-				next_move.captured_piece_type = target_square.piece_type;
-			} else {
-				next_move.is_capture = false;
-			}
 
-			finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+	// every square the knight jumps to, except those occupied by its own pieces or leaving its king in check
+	bitboard targets = knight_attacks[SQUARE_INDEX(rank, file)] & ~position->bitboards.occupied_by_color[COLOR_INDEX(is_knight_white)];
+	targets &= legal_targets_for_piece(gen, SQUARE_INDEX(rank, file)) & gen->target_filter;
+
+	while (targets) {
+		int target_square_idx = bitboard_pop_lsb(&targets);
+		int target_rank = SQUARE_RANK(target_square_idx);
+		int target_file = SQUARE_FILE(target_square_idx);
+
+		struct square target_square = get_square(position, target_rank, target_file);
+
+		next_move.target_rank = target_rank;
+		next_move.target_file = target_file;
+
+		if (target_square.has_piece) {
+			// we should never end up in situation where the target square has a king and the knight can capture it
+			assert(target_square.piece_type != PIECE_TYPE_KING);
+
+			next_move.is_capture = true;
+			next_move.captured_piece_type = target_square.piece_type;
+		} else {
+			next_move.is_capture = false;
 		}
+
+		finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 	}
 
 	return n_moves;
 }
 
-int find_all_possible_moves_in_direction(struct position *position, struct move **into, int rank, int file, int rank_dir, int file_dir) {
-	assert(rank >= 0 && rank <= 7);
-	assert(file >= 0 && rank <= 7);
-	assert(position->squares[rank][file].has_piece);
-
-	piece_type moved_piece_type = position->squares[rank][file].piece_type;
-	bool is_moved_piece_white = position->squares[rank][file].is_piece_white;
+// records a move from [rank][file] to every square in attacks not occupied by the moving piece's own color
+// attacks is the moving slider's attack set, straight from the magic tables
+static int find_all_possible_slider_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file, bitboard attacks) {
+	piece_type moved_piece_type = get_square(position, rank, file).piece_type;
+	bool is_moved_piece_white = get_square(position, rank, file).is_piece_white;
 
 	struct move next_move = {0};
 	next_move.piece_type = moved_piece_type;
 	next_move.is_piece_white = is_moved_piece_white;
 	next_move.source_rank = rank;
 	next_move.source_file = file;
-	
-	int target_rank = rank + rank_dir;
-	int target_file = file + file_dir;
 
 	int n_moves = 0;
 
-	while (1) {
-		if (target_rank < 0 || target_rank > 7 || target_file < 0 || target_file > 7) // we went out of bounds
-			break;
-	
-		struct square target_square = position->squares[target_rank][target_file];
-			
+	bitboard targets = attacks & ~position->bitboards.occupied_by_color[COLOR_INDEX(is_moved_piece_white)];
+	targets &= legal_targets_for_piece(gen, SQUARE_INDEX(rank, file)) & gen->target_filter;
+
+	while (targets) {
+		int target_square_idx = bitboard_pop_lsb(&targets);
+		int target_rank = SQUARE_RANK(target_square_idx);
+		int target_file = SQUARE_FILE(target_square_idx);
+
+		struct square target_square = get_square(position, target_rank, target_file);
+
 		next_move.target_rank = target_rank;
 		next_move.target_file = target_file;
 
 		if (target_square.has_piece) {
-			if (target_square.is_piece_white != is_moved_piece_white) {
-				// we should never end up in situation where the target square has a king, this is an invalid state
-				if (target_square.piece_type == PIECE_TYPE_KING) {
-					fprintf(stderr, "find_all_possible_moves_in_direction target square has a king of the opposite color, target square: [%d, %d], piece square: [%d, %d], piece: %d\n", 
-						target_rank, target_file, rank, file, moved_piece_type);
-					exit(1);
-				}
-
-				next_move.is_capture = true;
-				next_move.captured_piece_type = target_square.piece_type;
-				finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
+			// we should never end up in situation where the target square has a king, this is an invalid state
+			if (target_square.piece_type == PIECE_TYPE_KING) {
+				fprintf(stderr, "find_all_possible_slider_moves target square has a king of the opposite color, target square: [%d, %d], piece square: [%d, %d], piece: %d\n",
+					target_rank, target_file, rank, file, moved_piece_type);
+				exit(1);
 			}
-			break;
+
+			next_move.is_capture = true;
+			next_move.captured_piece_type = target_square.piece_type;
 		} else {
 			next_move.is_capture = false;
-			finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
 		}
 
-		target_rank += rank_dir;
-		target_file += file_dir;
+		finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
 	}
 
 	return n_moves;
 }
 
-int find_all_possible_bishop_moves(struct position *position, struct move **into, int rank, int file) {
+int find_all_possible_bishop_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
 	assert(rank >= 0 && rank <= 7);
-	assert(file >= 0 && rank <= 7);
-	assert(position->squares[rank][file].has_piece);
-	assert(position->squares[rank][file].piece_type == PIECE_TYPE_BISHOP);
-
-	int n_moves = 0;
-
-	// +1, +1 diagonal direction
-	int moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 1, 1);
-	n_moves += moves_in_direction;
-
-	// -1, +1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, -1, 1);
-	n_moves += moves_in_direction;
-
-	// -1, -1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, -1, -1);
-	n_moves += moves_in_direction;
-
-	// +1, -1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 1, -1);
-	n_moves += moves_in_direction;
+	assert(file >= 0 && file <= 7);
+	assert(get_square(position, rank, file).has_piece);
+	assert(get_square(position, rank, file).piece_type == PIECE_TYPE_BISHOP);
 
-	return n_moves;
+	bitboard attacks = bishop_attacks(SQUARE_INDEX(rank, file), position->bitboards.occupied);
+	return find_all_possible_slider_moves(position, gen, into, rank, file, attacks);
 }
 
 
-int find_all_possible_rook_moves(struct position *position, struct move **into, int rank, int file) {
+int find_all_possible_rook_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
 	assert(rank >= 0 && rank <= 7);
-	assert(file >= 0 && rank <= 7);
-	assert(position->squares[rank][file].has_piece);
-	assert(position->squares[rank][file].piece_type == PIECE_TYPE_ROOK);
-
-	int n_moves = 0;
-
-	int moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 1, 0);
-	n_moves += moves_in_direction;
-
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, -1, 0);
-	n_moves += moves_in_direction;
-	
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 0, 1);
-	n_moves += moves_in_direction;
-	
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 0, -1);
-	n_moves += moves_in_direction;
+	assert(file >= 0 && file <= 7);
+	assert(get_square(position, rank, file).has_piece);
+	assert(get_square(position, rank, file).piece_type == PIECE_TYPE_ROOK);
 
-	return n_moves;
+	bitboard attacks = rook_attacks(SQUARE_INDEX(rank, file), position->bitboards.occupied);
+	return find_all_possible_slider_moves(position, gen, into, rank, file, attacks);
 }
 
-int find_all_possible_queen_moves(struct position *position, struct move **into, int rank, int file) {
+int find_all_possible_queen_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
 	assert(rank >= 0 && rank <= 7);
-	assert(file >= 0 && rank <= 7);
-	assert(position->squares[rank][file].has_piece);
-	assert(position->squares[rank][file].piece_type == PIECE_TYPE_QUEEN);
-
-	int n_moves = 0;
-
-	// towards rank 7
-	int moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 1, 0);
-	n_moves += moves_in_direction;
-
-	// toward rank 0
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, -1, 0);
-	n_moves += moves_in_direction;
-	
-	// toward file 7
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 0, 1);
-	n_moves += moves_in_direction;
-	
-	// toward file 0
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 0, -1);
-	n_moves += moves_in_direction;
-
-	// +1, +1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 1, 1);
-	n_moves += moves_in_direction;
-
-	// -1, +1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, -1, 1);
-	n_moves += moves_in_direction;
+	assert(file >= 0 && file <= 7);
+	assert(get_square(position, rank, file).has_piece);
+	assert(get_square(position, rank, file).piece_type == PIECE_TYPE_QUEEN);
 
-	// -1, -1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, -1, -1);
-	n_moves += moves_in_direction;
+	bitboard attacks = queen_attacks(SQUARE_INDEX(rank, file), position->bitboards.occupied);
+	return find_all_possible_slider_moves(position, gen, into, rank, file, attacks);
+}
 
-	// +1, -1 diagonal direction
-	moves_in_direction = find_all_possible_moves_in_direction(position, into, rank, file, 1, -1);
-	n_moves += moves_in_direction;
+// returns whether the king of the generated color, is_king_white, would be attacked on square
+// the king itself is taken off the board first, so it can't hide behind itself from a slider checking it along a line
+static FORCE_INLINE bool is_square_attacked_for_king(const struct position *position, const struct move_gen *gen, int square, const bool is_king_white) {
+	bitboard occupied = position->bitboards.occupied & ~SQUARE_BIT(gen->king_square);
+	return is_square_attacked_by_color(position, square, occupied, is_king_white ? COLOR_BLACK : COLOR_WHITE);
+}
 
-	return n_moves;
+// castles the king of color is_king_white towards rook_file if it has the castling right for that side and the move is legal
+// the king must be on its starting square and not in check
+static FORCE_INLINE void find_castling_move(struct position *position, const struct move_gen *gen, struct move_sink *into, struct move *next_move, int *n_moves,
+		const bool is_king_white, const int rook_file) {
+	const int back_rank = is_king_white ? 0 : 7;
+	const int opposing_color = is_king_white ? COLOR_BLACK : COLOR_WHITE;
+	const bool is_kingside = rook_file == 7;
+	const uint8_t castling_right = is_king_white ? (is_kingside ? CASTLE_WHITE_KINGSIDE : CASTLE_WHITE_QUEENSIDE) : (is_kingside ? CASTLE_BLACK_KINGSIDE : CASTLE_BLACK_QUEENSIDE);
+	// the king ends up on the g or c file, passing over the f or d file
+	const int king_target_file = is_kingside ? 6 : 2;
+	const int king_passed_file = is_kingside ? 5 : 3;
+	// the squares between king and rook that have to be empty: f and g kingside, b, c and d queenside
+	const bitboard must_be_empty = squares_between[SQUARE_INDEX(back_rank, 4)][SQUARE_INDEX(back_rank, rook_file)];
+
+	// in all the below situations, we need to check the following:
+	// 1. that we have our castling rights in the appropriate direction, and the rook is still there
+	// 2. that there are no pieces in the way between the king's initial position and the rook's initial position
+	// 3. that we are not castling through or into check
+	if (!(position->castling_rights & castling_right))
+		return;
+	if (!(position->bitboards.pieces[COLOR_INDEX(is_king_white)][PIECE_TYPE_ROOK] & SQUARE_BIT(SQUARE_INDEX(back_rank, rook_file))))
+		return;
+	if (position->bitboards.occupied & must_be_empty)
+		return;
+	if (is_square_attacked_by_color(position, SQUARE_INDEX(back_rank, king_passed_file), position->bitboards.occupied, opposing_color) ||
+			is_square_attacked_by_color(position, SQUARE_INDEX(back_rank, king_target_file), position->bitboards.occupied, opposing_color))
+		return;
+
+	next_move->is_capture = false;
+	next_move->target_rank = back_rank;
+	next_move->target_file = king_target_file;
+	finalize_move_info_and_record(position, gen, next_move, into, n_moves);
 }
 
-// returns the number of possible moves a king located at [rank][file] on the position can make
+// returns the number of possible moves a king located at [rank][file] on the position can make, the king's color must be is_king_white
 // places the possible moves into the *into param, if into is NULL, it just counts the number of moves without recording them
-int find_all_possible_king_moves(struct position *position, struct move **into, int king_rank, int king_file) {
+static FORCE_INLINE int find_all_possible_king_moves(struct position *position, const struct move_gen *gen, struct move_sink *into, int king_rank, int king_file, const bool is_king_white) {
 	assert(king_rank >= 0 && king_rank <= 7);
 	assert(king_file >= 0 && king_file <= 7);
-	assert(position->squares[king_rank][king_file].has_piece);
-	assert(position->squares[king_rank][king_file].piece_type == PIECE_TYPE_KING);
+	assert(get_square(position, king_rank, king_file).has_piece);
+	assert(get_square(position, king_rank, king_file).piece_type == PIECE_TYPE_KING);
+	assert(get_square(position, king_rank, king_file).is_piece_white == is_king_white);
 
-	bool is_king_white = position->squares[king_rank][king_file].is_piece_white;
+	const int color = COLOR_INDEX(is_king_white);
 
 	struct move next_move = {0};
 	next_move.piece_type = PIECE_TYPE_KING;
@@ -828,139 +1189,78 @@ int find_all_possible_king_moves(struct position *position, struct move **into,
 
 	int n_moves = 0;
 
-	for (int i = 0; i < 8; i++) {
-		int target_rank = king_rank + king_move_rank_offsets[i];
-		int target_file = king_file + king_move_file_offsets[i];
+	// every square next to the king, except those occupied by its own pieces
+	bitboard targets = king_attacks[SQUARE_INDEX(king_rank, king_file)] & ~position->bitboards.occupied_by_color[color] & gen->target_filter;
 
-		if (target_rank < 0 || target_rank > 7 || target_file < 0 || target_file > 7)
+	while (targets) {
+		int target_square_idx = bitboard_pop_lsb(&targets);
+		if (is_square_attacked_for_king(position, gen, target_square_idx, is_king_white))
 			continue;
 
-		struct square target_square = position->squares[target_rank][target_file];
+		int target_rank = SQUARE_RANK(target_square_idx);
+		int target_file = SQUARE_FILE(target_square_idx);
+
+		struct square target_square = get_square(position, target_rank, target_file);
 
 		next_move.target_rank = target_rank;
 		next_move.target_file = target_file;
 
 		if (target_square.has_piece) {
-			if (target_square.is_piece_white != is_king_white) {
-				next_move.is_capture = true;
-				next_move.captured_piece_type = target_square.piece_type;
-
-				finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-			}
-			continue;
+			next_move.is_capture = true;
+			next_move.captured_piece_type = target_square.piece_type;
 		} else {
 			next_move.is_capture = false;
-			finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
 		}
-	}
-
-	// castling moves
-	// TODO: factor out the logic, lots of duplication here
-	{
-		next_move.is_capture = false;
-
-		// in all the below situations, we need to check the following:
-		// 1. that we have our castling rights in the appropriate direction
-		// 2. that we are not castling through check
-		// 3. that there are no pieces in the way between the king's initial position and the rook's initial position
-		if (is_king_white) {
-			if (king_rank == 0 && king_file == 4) {
-				if (position->white_can_castle_kingside) {
-					// we can't castle if f1 is under attack, since that would be castling through check
-					bool is_f1_hit = is_square_attacked_by_piece_of_color(position, 0, 5, !is_king_white);
-					if (!is_f1_hit) {
-						// check f1 & g1 for pieces
-						if (!position->squares[0][5].has_piece && !position->squares[0][6].has_piece) {
-							// we should be able to castle at this point
-							next_move.target_rank = 0;
-							next_move.target_file = 6;
-							finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-						}
-					}
-				}
 
-				if (position->white_can_castle_queenside) {
-					// we can't castle if d1 is under attack, since that would be castling through check
-					bool is_d1_hit = is_square_attacked_by_piece_of_color(position, 0, 3, !is_king_white);
-					if (!is_d1_hit) {
-						// check b1, c1, d1 for pieces
-						if (!position->squares[0][1].has_piece && !position->squares[0][2].has_piece && !position->squares[0][3].has_piece) {
-							// we should be able to castle at this point
-							next_move.target_rank = 0;
-							next_move.target_file = 2;
-							finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-						}
-					}
-				}
-			}
-		} else {
-			if (king_rank == 7 && king_file == 4) {
-				if (position->black_can_castle_kingside) {
-					// we can't castle if f8 is under attack, since that would be castling through check
-					bool is_f8_hit = is_square_attacked_by_piece_of_color(position, 7, 5, !is_king_white);
-					if (!is_f8_hit) {
-						// check f8 & g8 for pieces
-						if (!position->squares[7][5].has_piece && !position->squares[7][6].has_piece) {
-							// we should be able to castle at this point
-							next_move.target_rank = 7;
-							next_move.target_file = 6;
-							finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-						}
-					}
-				}
+		finalize_move_info_and_record(position, gen, &next_move, into, &n_moves);
+	}
 
-				if (position->black_can_castle_queenside) {
-					// we can't castle if d8 is under attack, since that would be castling through check
-					bool is_d8_hit = is_square_attacked_by_piece_of_color(position, 7, 3, !is_king_white);
-					if (!is_d8_hit) {
-						// check b8, c8, d8 for pieces
-						if (!position->squares[7][1].has_piece && !position->squares[7][2].has_piece && !position->squares[7][3].has_piece) {
-							// we should be able to castle at this point
-							next_move.target_rank = 7;
-							next_move.target_file = 2;
-							finalize_move_info_and_record_if_legal(position, &next_move, into, &n_moves);
-						}
-					}
-				}
-			}
-		}
+	// castling moves, castling is never possible out of check
+	if (gen->has_quiet && gen->checkers == 0 && king_rank == (is_king_white ? 0 : 7) && king_file == 4) {
+		find_castling_move(position, gen, into, &next_move, &n_moves, is_king_white, 7);
+		find_castling_move(position, gen, into, &next_move, &n_moves, is_king_white, 0);
 	}
-	
+
 	return n_moves;
 }
 
-int find_all_possible_moves_for_piece(struct position *position, struct move *into, int rank, int file) {
-	piece_type piece_type = position->squares[rank][file].piece_type;
-	
+// generates the legal moves of the piece on [rank][file], gen must have been set up for is_color_white, the piece's color, on this position
+static FORCE_INLINE int find_legal_moves_for_piece_of_color(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file, const bool is_color_white) {
+	piece_type piece_type = get_square(position, rank, file).piece_type;
+
+	// in double check, only the king can move
+	if (gen->check_mask == 0 && piece_type != PIECE_TYPE_KING)
+		return 0;
+
 	int n_piece_moves;
 	switch (piece_type) {
 		case PIECE_TYPE_PAWN: {
-			n_piece_moves = find_all_possible_pawn_moves(position, &into, rank, file);
+			n_piece_moves = find_all_possible_pawn_moves(position, gen, into, rank, file, is_color_white);
 		}
 		break;
 
 		case PIECE_TYPE_KNIGHT: {
-			n_piece_moves = find_all_possible_knight_moves(position, &into, rank, file);
+			n_piece_moves = find_all_possible_knight_moves(position, gen, into, rank, file);
 		};
 		break;
 
 		case PIECE_TYPE_BISHOP: {
-			n_piece_moves = find_all_possible_bishop_moves(position, &into, rank, file);
+			n_piece_moves = find_all_possible_bishop_moves(position, gen, into, rank, file);
 		};
 		break;
 
 		case PIECE_TYPE_ROOK: {
-			n_piece_moves = find_all_possible_rook_moves(position, &into, rank, file);
+			n_piece_moves = find_all_possible_rook_moves(position, gen, into, rank, file);
 		};
 		break;
 
 		case PIECE_TYPE_QUEEN: {
-			n_piece_moves = find_all_possible_queen_moves(position, &into, rank, file);
+			n_piece_moves = find_all_possible_queen_moves(position, gen, into, rank, file);
 		};
 		break;
 
 		case PIECE_TYPE_KING: {
-			n_piece_moves = find_all_possible_king_moves(position, &into, rank, file);
+			n_piece_moves = find_all_possible_king_moves(position, gen, into, rank, file, is_color_white);
 		};
 		break;
 
@@ -968,39 +1268,338 @@ int find_all_possible_moves_for_piece(struct position *position, struct move *in
 			fprintf(stderr, "find_all_possible_moves_for_piece: got illegal piece %d at %d %d\n", piece_type, rank, file);
 			exit(1);
 	}
-	
+
 	return n_piece_moves;
 }
 
-// returns the total count of all possible moves on the position for the provided piece_color
+// the two instances of the generators above
+static int find_legal_moves_for_white_piece(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
+	return find_legal_moves_for_piece_of_color(position, gen, into, rank, file, true);
+}
+
+static int find_legal_moves_for_black_piece(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
+	return find_legal_moves_for_piece_of_color(position, gen, into, rank, file, false);
+}
+
+// generates the legal moves of the piece on [rank][file], gen must have been set up for the piece's color on this position
+static int find_legal_moves_for_piece(struct position *position, const struct move_gen *gen, struct move_sink *into, int rank, int file) {
+	if (gen->is_color_white)
+		return find_legal_moves_for_white_piece(position, gen, into, rank, file);
+	return find_legal_moves_for_black_piece(position, gen, into, rank, file);
+}
+
+int find_all_possible_moves_for_piece(struct position *position, struct move *into, int rank, int file) {
+	assert(get_square(position, rank, file).has_piece);
+
+	struct move_gen gen;
+	init_move_gen(position, get_square(position, rank, file).is_piece_white, MOVE_GEN_ANNOTATE_CHECKS, &gen);
+
+	struct move_sink sink = { into, NULL };
+	return find_legal_moves_for_piece(position, &gen, &sink, rank, file);
+}
+
+// returns the total count of all legal moves on the position for the provided color
 // places the legal moves into the into arg, if one is provided
 // if into is NULL, it just returns the count of moves without trying to record them
-int find_all_possible_moves_for_color(struct position *position, struct move *into, bool is_color_white) {
+// pins and checks are worked out once up front, so every generated move is legal without having to be tried out on the position
+static int generate_moves_with_gen(struct position *position, const struct move_gen *gen, struct move_sink *sink) {
 	int n_moves = 0;
 
-	for (int rank = 0; rank < 8; rank++) {
-		for (int file = 0; file < 8; file++) {
-			struct square current_square = position->squares[rank][file];
+	// only visit the squares holding the color's pieces, in the same rank 0 to 7, file 0 to 7 order as a board scan
+	bitboard pieces = position->bitboards.occupied_by_color[COLOR_INDEX(gen->is_color_white)];
 
-			if (!current_square.has_piece)
-				continue;
-			
-			if (current_square.is_piece_white != is_color_white)
-				continue;
-	
-			int n_piece_moves = find_all_possible_moves_for_piece(position, into, rank, file);
-			n_moves += n_piece_moves;
-			if (into != NULL)
-				into += n_piece_moves;
+	// the color is settled once here, every piece is then handed straight to that color's instance of the generators
+	if (gen->is_color_white) {
+		while (pieces) {
+			int square = bitboard_pop_lsb(&pieces);
+			n_moves += find_legal_moves_for_white_piece(position, gen, sink, SQUARE_RANK(square), SQUARE_FILE(square));
+		}
+	} else {
+		while (pieces) {
+			int square = bitboard_pop_lsb(&pieces);
+			n_moves += find_legal_moves_for_black_piece(position, gen, sink, SQUARE_RANK(square), SQUARE_FILE(square));
 		}
 	}
 
 	return n_moves;
 }
 
-// returns whether the move provided mates the opposing king
+static int generate_moves_into_sink(struct position *position, struct move_sink *sink, bool is_color_white, int gen_flags) {
+	struct move_gen gen;
+	init_move_gen(position, is_color_white, gen_flags, &gen);
+	return generate_moves_with_gen(position, &gen, sink);
+}
+
+int generate_moves_for_color(struct position *position, struct move *into, bool is_color_white, int gen_flags) {
+	struct move_sink sink = { into, NULL };
+	return generate_moves_into_sink(position, &sink, is_color_white, gen_flags);
+}
+
+int generate_noisy_moves_for_color(struct position *position, struct move *into, bool is_color_white) {
+	return generate_moves_for_color(position, into, is_color_white, MOVE_GEN_NOISY_ONLY);
+}
+
+int generate_quiet_moves_for_color(struct position *position, struct move *into, bool is_color_white) {
+	return generate_moves_for_color(position, into, is_color_white, MOVE_GEN_QUIET_ONLY);
+}
+
+int generate_packed_moves_for_color(struct position *position, packed_move *into, bool is_color_white) {
+	struct move_sink sink = { NULL, into };
+	return generate_moves_into_sink(position, &sink, is_color_white, 0);
+}
+
+int find_all_possible_moves_for_color(struct position *position, struct move *into, bool is_color_white) {
+	return generate_moves_for_color(position, into, is_color_white, MOVE_GEN_ANNOTATE_CHECKS);
+}
+
+// stops at the first legal move found instead of generating them all
+// the moves most likely to exist when in check are tried first: king moves, then capturing the checking piece
+bool has_any_legal_move(struct position *position, bool is_color_white) {
+	struct move_gen gen;
+	init_move_gen(position, is_color_white, 0, &gen);
+
+	const struct bitboard_position *bitboards = &position->bitboards;
+	int color = COLOR_INDEX(is_color_white);
+	bitboard own_pieces = bitboards->occupied_by_color[color];
+
+	// castling is left out, a king that can castle can also step onto the square it passes through
+	bitboard king_targets = king_attacks[gen.king_square] & ~own_pieces;
+	while (king_targets) {
+		int target_square = bitboard_pop_lsb(&king_targets);
+		if (!is_square_attacked_for_king(position, &gen, target_square, is_color_white))
+			return true;
+	}
+
+	// in double check only the king can move
+	if (gen.check_mask == 0)
+		return false;
+
+	// a pinned piece can never take the piece giving check, since it would have to leave the line it's pinned on
+	if (gen.checkers) {
+		int checker_square = bitboard_lsb(gen.checkers);
+		bitboard capturers = attackers_to_square(position, checker_square, bitboards->occupied) & own_pieces & ~bitboards->pieces[color][PIECE_TYPE_KING];
+		if (capturers & ~gen.pinned)
+			return true;
+	}
+
+	// knights and sliders only need a non-empty target set, pawns have enough special cases to just go through their generator
+	bitboard pieces = own_pieces & ~bitboards->pieces[color][PIECE_TYPE_KING];
+	while (pieces) {
+		int square = bitboard_pop_lsb(&pieces);
+		bitboard targets;
+
+		switch (get_square(position, SQUARE_RANK(square), SQUARE_FILE(square)).piece_type) {
+			case PIECE_TYPE_KNIGHT: targets = knight_attacks[square]; break;
+			case PIECE_TYPE_BISHOP: targets = bishop_attacks(square, bitboards->occupied); break;
+			case PIECE_TYPE_ROOK: targets = rook_attacks(square, bitboards->occupied); break;
+			case PIECE_TYPE_QUEEN: targets = queen_attacks(square, bitboards->occupied); break;
+
+			default: {
+				struct move_sink count_only = { NULL, NULL };
+				if (find_legal_moves_for_piece(position, &gen, &count_only, SQUARE_RANK(square), SQUARE_FILE(square)) > 0)
+					return true;
+				continue;
+			}
+		}
+
+		if (targets & ~own_pieces & legal_targets_for_piece(&gen, square))
+			return true;
+	}
+
+	return false;
+}
+
+// the score of a noisy move for the picker, most valuable victim first and among equal victims the least valuable attacker
+// a promotion counts like capturing the material it gains, so a queen promotion comes right along with taking a queen
+static int score_noisy_move(const struct position *position, packed_move move) {
+	int flags = PACKED_MOVE_FLAGS(move);
+	packed_square attacker = position->board[PACKED_MOVE_SOURCE(move)];
+	packed_square victim = position->board[PACKED_MOVE_TARGET(move)];
+
+	int victim_value = 0;
+	if (flags == MOVE_FLAG_EN_PASSANT)
+		victim_value = piece_values[PIECE_TYPE_PAWN];
+	else if (victim != EMPTY_SQUARE)
+		victim_value = piece_values[PACKED_SQUARE_PIECE_TYPE(victim)];
+
+	if (flags & MOVE_FLAG_PROMOTION)
+		victim_value += piece_values[(flags & 3) + PIECE_TYPE_KNIGHT] - piece_values[PIECE_TYPE_PAWN];
+
+	// piece values are at least 10 apart, so the attacker only ever breaks ties between victims
+	return victim_value * 100 - piece_values[PACKED_SQUARE_PIECE_TYPE(attacker)];
+}
+
+// returns whether move is one of the legal moves of the picker's position, only the moves of the piece on its source square are generated
+static bool is_packed_move_legal(struct move_picker *picker, packed_move move) {
+	packed_square source = picker->position->board[PACKED_MOVE_SOURCE(move)];
+	if (source == EMPTY_SQUARE || PACKED_SQUARE_IS_PIECE_WHITE(source) != picker->gen.is_color_white)
+		return false;
+
+	packed_move piece_moves[32];
+	struct move_sink sink = { NULL, piece_moves };
+	int n_piece_moves = find_legal_moves_for_piece(picker->position, &picker->gen, &sink, SQUARE_RANK(PACKED_MOVE_SOURCE(move)), SQUARE_FILE(PACKED_MOVE_SOURCE(move)));
+
+	for (int i = 0; i < n_piece_moves; i++) {
+		if (piece_moves[i] == move)
+			return true;
+	}
+	return false;
+}
+
+// fills the picker's list with the moves of the gen_flags stage, the noisy moves are scored, the quiet ones only with a history
+static void generate_picker_stage(struct move_picker *picker, int gen_flags) {
+	set_move_gen_flags(picker->position, &picker->gen, gen_flags);
+
+	struct move_sink sink = { NULL, picker->moves };
+	picker->n_moves = generate_moves_with_gen(picker->position, &picker->gen, &sink);
+	picker->next_idx = 0;
+
+	if (gen_flags & MOVE_GEN_NOISY_ONLY) {
+		for (int i = 0; i < picker->n_moves; i++)
+			picker->scores[i] = score_noisy_move(picker->position, picker->moves[i]);
+	} else if (picker->history != NULL) {
+		const int16_t (*butterfly)[64] = picker->history->butterfly[COLOR_INDEX(picker->gen.is_color_white)];
+		for (int i = 0; i < picker->n_moves; i++)
+			picker->scores[i] = butterfly[PACKED_MOVE_SOURCE(picker->moves[i])][PACKED_MOVE_TARGET(picker->moves[i])];
+	}
+}
+
+// moves the highest scored of the moves not handed out yet to next_idx and returns it
+// selection sort one step at a time, most of the time only the first few moves are ever looked at
+static packed_move select_best_move(struct move_picker *picker) {
+	int best_idx = picker->next_idx;
+	for (int i = picker->next_idx + 1; i < picker->n_moves; i++) {
+		if (picker->scores[i] > picker->scores[best_idx])
+			best_idx = i;
+	}
+
+	packed_move best = picker->moves[best_idx];
+	picker->moves[best_idx] = picker->moves[picker->next_idx];
+	picker->scores[best_idx] = picker->scores[picker->next_idx];
+	picker->next_idx++;
+	return best;
+}
+
+// whether move was already handed out as the hash move or as a refutation
+static bool is_move_picked_early(const struct move_picker *picker, packed_move move) {
+	return move == picker->hash_move || move == picker->refutations[0] || move == picker->refutations[1] || move == picker->refutations[2];
+}
+
+void init_move_picker(struct move_picker *picker, struct position *position, bool is_color_white, packed_move hash_move) {
+	picker->position = position;
+	init_move_gen(position, is_color_white, 0, &picker->gen);
+	picker->hash_move = hash_move;
+	picker->stage = PICK_STAGE_HASH_MOVE;
+	picker->is_noisy_only = false;
+	picker->history = NULL;
+	picker->refutations[0] = PACKED_MOVE_NONE;
+	picker->refutations[1] = PACKED_MOVE_NONE;
+	picker->refutations[2] = PACKED_MOVE_NONE;
+	picker->n_moves = 0;
+	picker->next_idx = 0;
+}
+
+void init_ordered_move_picker(struct move_picker *picker, struct position *position, bool is_color_white, packed_move hash_move,
+                              const struct move_history *history, const packed_move killers[2], packed_move previous_move) {
+	init_move_picker(picker, position, is_color_white, hash_move);
+	picker->history = history;
+	picker->refutations[0] = killers[0];
+	picker->refutations[1] = killers[1];
+	if (previous_move != PACKED_MOVE_NONE) {
+		int previous_target = PACKED_MOVE_TARGET(previous_move);
+		picker->refutations[2] = history->countermoves[position->board[previous_target]][previous_target];
+	}
+}
+
+void init_noisy_move_picker(struct move_picker *picker, struct position *position, bool is_color_white) {
+	init_move_picker(picker, position, is_color_white, PACKED_MOVE_NONE);
+	picker->stage = PICK_STAGE_GENERATE_NOISY;
+	picker->is_noisy_only = true;
+}
+
+bool pick_next_move(struct move_picker *picker, struct move *into) {
+	for (;;) {
+		switch (picker->stage) {
+			case PICK_STAGE_HASH_MOVE: {
+				picker->stage = PICK_STAGE_GENERATE_NOISY;
+				if (picker->hash_move != PACKED_MOVE_NONE && is_packed_move_legal(picker, picker->hash_move)) {
+					unpack_move(picker->position, picker->hash_move, into);
+					return true;
+				}
+				picker->hash_move = PACKED_MOVE_NONE;
+			}
+			break;
+
+			case PICK_STAGE_GENERATE_NOISY: {
+				generate_picker_stage(picker, MOVE_GEN_NOISY_ONLY);
+				picker->stage = PICK_STAGE_NOISY;
+			}
+			break;
+
+			case PICK_STAGE_NOISY: {
+				while (picker->next_idx < picker->n_moves) {
+					packed_move best = select_best_move(picker);
+					if (best != picker->hash_move) {
+						unpack_move(picker->position, best, into);
+						return true;
+					}
+				}
+				picker->stage = picker->is_noisy_only ? PICK_STAGE_DONE : PICK_STAGE_REFUTATIONS;
+				picker->next_idx = 0;
+
+				// the refutations are checked for legality with the generator, which has to produce quiet moves again for that
+				set_move_gen_flags(picker->position, &picker->gen, MOVE_GEN_QUIET_ONLY);
+			}
+			break;
+
+			// next_idx goes through the refutations here, the ones not handed out are cleared so the quiet stage doesn't skip them
+			case PICK_STAGE_REFUTATIONS: {
+				while (picker->next_idx < 3) {
+					int idx = picker->next_idx++;
+					packed_move move = picker->refutations[idx];
+					if (move == PACKED_MOVE_NONE)
+						continue;
+
+					bool is_repeat = move == picker->hash_move || (idx >= 1 && move == picker->refutations[0]) || (idx == 2 && move == picker->refutations[1]);
+					if (!is_repeat && !is_packed_move_noisy(picker->position, move) && is_packed_move_legal(picker, move)) {
+						unpack_move(picker->position, move, into);
+						return true;
+					}
+					if (!is_repeat)
+						picker->refutations[idx] = PACKED_MOVE_NONE;
+				}
+				picker->stage = PICK_STAGE_GENERATE_QUIET;
+			}
+			break;
+
+			case PICK_STAGE_GENERATE_QUIET: {
+				generate_picker_stage(picker, MOVE_GEN_QUIET_ONLY);
+				picker->stage = PICK_STAGE_QUIET;
+			}
+			break;
+
+			case PICK_STAGE_QUIET: {
+				while (picker->next_idx < picker->n_moves) {
+					packed_move move = picker->history != NULL ? select_best_move(picker) : picker->moves[picker->next_idx++];
+					if (!is_move_picked_early(picker, move)) {
+						unpack_move(picker->position, move, into);
+						return true;
+					}
+				}
+				picker->stage = PICK_STAGE_DONE;
+			}
+			break;
+
+			default:
+				return false;
+		}
+	}
+}
+
+// returns whether the move provided checks, mates or stalemates the opposing king
 int is_move_check_or_mate(struct position *position, struct move *move) {
-	apply_move_to_position(position, move);
+	struct undo_info undo;
+	make_move(position, move, &undo);
 
 	bool is_white_move = move->is_piece_white;
 
@@ -1009,19 +1608,39 @@ int is_move_check_or_mate(struct position *position, struct move *move) {
 
 	bool is_check = is_king_on_square_in_check(position, king_rank, king_file);
 	
-	// do not want to record all possible moves, just want a count, so pass NULL for the 2nd arg
-	int n_moves = find_all_possible_moves_for_color(position, NULL, !is_white_move);
+	// only whether the opponent has any reply at all matters, not how many
+	bool has_reply = has_any_legal_move(position, !is_white_move);
 
-	undo_move_from_position(position, move);
+	unmake_move(position, move, &undo);
 	
 	if (is_check) {
-		if (n_moves == 0)
+		if (!has_reply)
 			return MOVE_IS_MATE;
 		return MOVE_IS_CHECK;
 	}
+	if (!has_reply)
+		return MOVE_IS_STALEMATE;
 	return MOVE_IS_NOT_CHECK_OR_MATE;
 }
 
+void annotate_move(struct position *position, struct move *move) {
+	move->is_check = false;
+	move->is_mate = false;
+
+	int move_result = is_move_check_or_mate(position, move);
+	if (move_result == MOVE_IS_MATE) {
+		move->is_mate = true;
+	} else if (move_result == MOVE_IS_CHECK) {
+		move->is_check = true;
+	}
+}
+
+void annotate_moves(struct position *position, struct move *moves, int n_moves) {
+	for (int i = 0; i < n_moves; i++) {
+		annotate_move(position, &moves[i]);
+	}
+}
+
 /*
 int main(void) {
 	struct position position;
@@ -1,15 +1,27 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "bitboard.h"
 
 typedef enum { PIECE_TYPE_PAWN, PIECE_TYPE_KNIGHT, PIECE_TYPE_BISHOP, PIECE_TYPE_ROOK, PIECE_TYPE_QUEEN, PIECE_TYPE_KING } piece_type;
 
+// the unpacked form of a square, as get_square returns it
 struct square {
 	bool has_piece;
 	bool is_piece_white; // if has_piece, whether the piece color on this square is white
 	piece_type piece_type;
 };
 
+// a square packed in one byte, 0 if it's empty, otherwise piece_type + 1 in the low 3 bits and bit 3 set for a black piece
+typedef uint8_t packed_square;
+
+#define EMPTY_SQUARE ((packed_square)0)
+#define PACKED_SQUARE(type, is_piece_white) ((packed_square)(((type) + 1) | ((is_piece_white) ? 0 : 8)))
+#define PACKED_SQUARE_PIECE_TYPE(packed) (((packed) & 7) - 1)
+#define PACKED_SQUARE_IS_PIECE_WHITE(packed) (((packed) & 8) == 0)
+
 struct move {
 	piece_type piece_type;
 	bool is_piece_white;
@@ -26,60 +38,325 @@ struct move {
 	piece_type piece_type_promoted_to;
 };
 
+// a move in 16 bits, for move lists and histories that need to stay small
+// bits 0-5 are the source square, bits 6-11 the target square (SQUARE_INDEX), bits 12-15 the MOVE_FLAG_* flags
+// the moving and captured pieces aren't stored, they are read back from the position the move is played on by unpack_move
+typedef uint16_t packed_move;
+
+#define MOVE_FLAG_NONE 0
+#define MOVE_FLAG_EN_PASSANT 1
+#define MOVE_FLAG_CASTLE 2
+// a promotion's flags are MOVE_FLAG_PROMOTION | (promoted piece type - PIECE_TYPE_KNIGHT)
+#define MOVE_FLAG_PROMOTION 4
+
+#define PACKED_MOVE(source_square, target_square, flags) ((packed_move)((source_square) | ((target_square) << 6) | ((flags) << 12)))
+#define PACKED_MOVE_SOURCE(packed) ((packed) & 63)
+#define PACKED_MOVE_TARGET(packed) (((packed) >> 6) & 63)
+#define PACKED_MOVE_FLAGS(packed) ((packed) >> 12)
+
+// never a legal move, since its source and target squares are the same
+#define PACKED_MOVE_NONE ((packed_move)0)
+
+// the piece placement of a position as sets of squares
+// pieces[color][piece_type] holds the squares of every piece of that color and type, color is COLOR_WHITE or COLOR_BLACK
+struct bitboard_position {
+	bitboard pieces[2][6];
+	bitboard occupied_by_color[2];
+	bitboard occupied;
+};
+
+// the file value of position::en_passant_file when no pawn can be captured en passant
+#define NO_EN_PASSANT_FILE 8
 
 struct position {
-	// [rank][file]
-	struct square squares[8][8];
+	// indexed by SQUARE_INDEX(rank, file), read with get_square
+	packed_square board[64];
 
-	int white_king_rank;
-	int white_king_file;
-	int black_king_rank;
-	int black_king_file;
-	
-	bool white_can_castle_kingside;
-	bool black_can_castle_kingside;
-	bool white_can_castle_queenside;
-	bool black_can_castle_queenside;
+	// the same piece placement as board, kept in sync with it by apply_move_to_position
+	struct bitboard_position bitboards;
+
+	// zobrist hash of the pieces, castling rights, en passant file and side to move, see position_hash
+	// set by load_fen_to_position and updated move by move by make_move/unmake_move
+	uint64_t hash;
+
+	// the number of pieces of each [color][piece_type] and the sum of their piece_values per color, kept in sync the same way as bitboards
+	// so material can be read without going over the board
+	uint8_t piece_counts[2][6];
+	int16_t material[2];
+
+	uint16_t halfmove_clock;     // plies since the last capture or pawn move, for the fifty move rule
+	uint16_t fullmove_number;    // starts at 1, goes up after every black move
+
+	uint8_t castling_rights : 4;     // CASTLE_* bits
+	uint8_t en_passant_file : 4;     // the file of a pawn that just moved 2 squares and an opposing pawn stands next to, or NO_EN_PASSANT_FILE
+};
+
+// the square [rank][file] of the position unpacked, for code that reads the board one square at a time
+static inline struct square get_square(const struct position *position, int rank, int file) {
+	packed_square packed = position->board[SQUARE_INDEX(rank, file)];
+
+	struct square square;
+	square.has_piece = packed != EMPTY_SQUARE;
+	square.is_piece_white = PACKED_SQUARE_IS_PIECE_WHITE(packed);
+	square.piece_type = square.has_piece ? PACKED_SQUARE_PIECE_TYPE(packed) : PIECE_TYPE_PAWN;
+	return square;
+}
 
-	bool can_en_passant[8]; // per file, regardless of color
+// only sets the board, the bitboards and everything else derived from the pieces has to be brought up to date separately
+static inline void set_square(struct position *position, int rank, int file, struct square square) {
+	if (square.has_piece)
+		position->board[SQUARE_INDEX(rank, file)] = PACKED_SQUARE(square.piece_type, square.is_piece_white);
+	else
+		position->board[SQUARE_INDEX(rank, file)] = EMPTY_SQUARE;
+}
+
+// whether an opposing pawn stands right next to the pawn on pawn_square, which has just moved 2 squares
+// only then does the position get an en passant file, otherwise it would hash differently depending on how it was reached
+static inline bool can_pawn_be_captured_en_passant(const struct position *position, int pawn_square, bool is_pawn_white) {
+	bitboard pawn = SQUARE_BIT(pawn_square);
+	bitboard neighbors = ((pawn << 1) & ~FILE_A_BITS) | ((pawn >> 1) & ~FILE_H_BITS);
+	return (neighbors & position->bitboards.pieces[COLOR_INDEX(!is_pawn_white)][PIECE_TYPE_PAWN]) != 0;
+}
+
+// bits of position::castling_rights and undo_info::castling_rights
+#define CASTLE_WHITE_KINGSIDE 1
+#define CASTLE_WHITE_QUEENSIDE 2
+#define CASTLE_BLACK_KINGSIDE 4
+#define CASTLE_BLACK_QUEENSIDE 8
+
+// the state make_move can't recover from the move itself, kept by the caller so unmake_move can restore the position in place
+struct undo_info {
+	bool has_captured_piece;
+	piece_type captured_piece_type;   // only applies if has_captured_piece == true
+	uint8_t castling_rights;          // CASTLE_* bits before the move
+	uint8_t en_passant_file;          // position::en_passant_file before the move
+	uint64_t hash;                    // position::hash before the move
+	int halfmove_clock;               // position::halfmove_clock before the move
 };
 
 #define GAME_ONGOING 0
 #define WHITE_WON 1
 #define BLACK_WON 2
+#define DRAW_BY_STALEMATE 3
+#define DRAW_BY_REPETITION 4
+#define DRAW_BY_FIFTY_MOVE_RULE 5
 
+// plies between two of game_state's full position snapshots
+#define GAME_CHECKPOINT_INTERVAL 16
+
+// a whole game, its history only stores the moves and a position every GAME_CHECKPOINT_INTERVAL plies
+// the arrays grow as the game goes on, so a game can be as long as it needs to be
 struct game_state {
-	struct position positions[256];
-	int n_positions;
-	
-	struct position *current_position;
+	struct position current_position;    // the position after the last move played
 	
 	bool white_to_move;
 	
 	int result;
 	
-	struct move moves[256];
+	// moves[ply] is the move played on the position at ply, ply 0 being the starting position
+	packed_move *moves;
 	int n_moves;
+
+	// hash_history[ply] is the hash of the position at ply, n_moves + 1 of them, looking for repetitions only reads these
+	uint64_t *hash_history;
+
+	// checkpoints[i] is the position at ply i * GAME_CHECKPOINT_INTERVAL, the plies in between are replayed from the one before them
+	struct position *checkpoints;
+	int n_checkpoints;
+
+	int plies_capacity;         // moves and hash_history have room for this many plies
+	int checkpoints_capacity;
 };
 
 // there up to 8 knight moves for a single knight
 // each pair of values here are a potential knight move
-static int knight_move_rank_offsets[8] = { 2, 1, -1, -2, -2, -1,  1,  2 };
-static int knight_move_file_offsets[8] = { 1, 2,  2,  1, -1, -2, -2, -1 };
+static const int knight_move_rank_offsets[8] = { 2, 1, -1, -2, -2, -1,  1,  2 };
+static const int knight_move_file_offsets[8] = { 1, 2,  2,  1, -1, -2, -2, -1 };
 
 
 // a king can move in 8 directions, rank_offsets[i] and file_offsets[i] are one directional pair
-static int king_move_rank_offsets[8] = { -1, -1, -1,  0,  1, 1, 1, 0 };
-static int king_move_file_offsets[8] = {  1,  0, -1, -1, -1, 0, 1, 1 };
+static const int king_move_rank_offsets[8] = { -1, -1, -1,  0,  1, 1, 1, 0 };
+static const int king_move_file_offsets[8] = {  1,  0, -1, -1, -1, 0, 1, 1 };
+
 
+// the value of each piece_type in centipawns, the king has none since it can never be traded
+static const int piece_values[6] = { 100, 320, 330, 500, 900, 0 };
 
 #define MOVE_IS_NOT_CHECK_OR_MATE 0
 #define MOVE_IS_CHECK 1
 #define MOVE_IS_MATE 2
+#define MOVE_IS_STALEMATE 3
 int is_move_check_or_mate(struct position *position, struct move *move);
 
+// builds the bitboards for the piece placement in position->board
+void position_to_bitboard_position(const struct position *position, struct bitboard_position *into);
+
+// recounts piece_counts and material from the position's bitboards
+void count_pieces(struct position *position);
+
+// sets the piece placement (board, bitboards and piece counts) of into from bitboards
+// castling and en passant rights of into are left untouched, and so is its hash, which position_hash can recompute
+void bitboard_position_to_position(const struct bitboard_position *bitboards, struct position *into);
+
+// the zobrist hash of the position with is_white_to_move's color to move, computed from scratch
+// equal positions hash the same, so it can key caches of results per position
+// position::hash holds the same value kept up to date incrementally, building with CHESS_VERIFY_HASH checks it after every make_move
+uint64_t position_hash(const struct position *position, bool is_white_to_move);
+
+// returns the pieces of both colors attacking square, with sliders looking through the given occupancy
+bitboard attackers_to_square(const struct position *position, int square, bitboard occupied);
+
+bool is_square_attacked_by_piece_of_color(const struct position *position, int rank, int file, bool is_color_white);
+
+// static exchange evaluation, the material in centipawns the mover of a legal move comes out ahead by once every capture back
+// and forth on the move's target square has been played, each side capturing with its least valuable piece first and either
+// side free to stop capturing whenever that's better for it
+// it only looks at the one square, so pins, checks and threats elsewhere are ignored, negative means the move loses material
+int see(const struct position *position, const struct move *move);
+
 int find_all_possible_moves_for_piece(struct position *position, struct move *into, int rank, int file);
 
+// flags for generate_moves_for_color
+// MOVE_GEN_ANNOTATE_CHECKS fills in is_check/is_mate of every generated move, which costs a full reply generation per move
+// without it is_check/is_mate are left false, callers that need them later can use annotate_move/annotate_moves
+#define MOVE_GEN_ANNOTATE_CHECKS 1
+// MOVE_GEN_NOISY_ONLY only generates captures, en passant and promotions (including underpromotions), the forcing moves a
+// quiescence search looks at, MOVE_GEN_QUIET_ONLY only generates the rest, the two together are every legal move
+// at most one of them can be set, with neither every move is generated
+#define MOVE_GEN_NOISY_ONLY 2
+#define MOVE_GEN_QUIET_ONLY 4
+
+int generate_moves_for_color(struct position *position, struct move *into, bool is_color_white, int gen_flags);
+
+// same as generate_moves_for_color with MOVE_GEN_ANNOTATE_CHECKS
 int find_all_possible_moves_for_color(struct position *position, struct move *into, bool color_is_white);
 
-void apply_move_to_game_state(struct game_state *game_state, const struct move *the_move);
\ No newline at end of file
+// everything the generators need to only produce legal moves for one color, computed once per position
+// only chess.c fills it in, it's declared here so a move_picker can hold one
+struct move_gen {
+	int gen_flags;          // MOVE_GEN_* flags the generation was started with
+	bool is_color_white;
+	bool has_noisy;         // whether captures, en passant and promotions are generated
+	bool has_quiet;         // whether all the other moves are
+	bitboard target_filter; // the target squares has_noisy and has_quiet allow, for the pieces other than pawns
+	int king_square;
+	bitboard checkers;      // opposing pieces giving check to the king
+	bitboard check_mask;    // target squares that deal with the check (capturing or blocking the checker), every square when not in check
+	bitboard pinned;        // the color's own pieces pinned to its king
+};
+
+// whether move is a capture, en passant or a promotion in position, i.e. one of the moves MOVE_GEN_NOISY_ONLY generates
+static inline bool is_packed_move_noisy(const struct position *position, packed_move move) {
+	return (PACKED_MOVE_FLAGS(move) & (MOVE_FLAG_EN_PASSANT | MOVE_FLAG_PROMOTION)) || position->board[PACKED_MOVE_TARGET(move)] != EMPTY_SQUARE;
+}
+
+// what a search has learned about which quiet moves tend to be good, for a move_picker to try those first
+// the search keeps it up to date, the picker only reads it
+struct move_history {
+	// butterfly[color][source square][target square], higher the more often the move caused a beta cutoff, in any position
+	int16_t butterfly[2][64][64];
+
+	// countermoves[piece][target square] is the quiet move that last refuted piece moving to target square
+	// piece is the packed_square of the moving piece as it stands on the target square, so it includes the color
+	packed_move countermoves[16][64];
+};
+
+// the stages of a move_picker, in the order it goes through them
+#define PICK_STAGE_HASH_MOVE 0
+#define PICK_STAGE_GENERATE_NOISY 1
+#define PICK_STAGE_NOISY 2
+#define PICK_STAGE_REFUTATIONS 3
+#define PICK_STAGE_GENERATE_QUIET 4
+#define PICK_STAGE_QUIET 5
+#define PICK_STAGE_DONE 6
+
+// hands out the legal moves of a position one at a time, likely best first: the hash move, then captures and promotions
+// from the most valuable victim and least valuable attacker down, then the killers and the countermove, then the other quiet
+// moves from the highest butterfly history down, or in generation order for a picker without a history
+// a stage's moves are only generated once the stages before it run out, so a search that cuts off early skips the rest
+struct move_picker {
+	struct position *position;
+	struct move_gen gen;
+	packed_move hash_move;      // PACKED_MOVE_NONE if there is none or it turned out not to be legal
+	int stage;                  // PICK_STAGE_*
+	bool is_noisy_only;         // stops after the noisy moves, see init_noisy_move_picker
+
+	const struct move_history *history;   // NULL if quiet moves aren't ordered
+
+	// the killers and the countermove, quiet moves tried before the others are generated if they're legal here
+	// the refutation stage clears the ones it finds aren't, so the quiet stage can skip all that are left
+	packed_move refutations[3];
+
+	// the current stage's moves, the ones before next_idx have been handed out
+	packed_move moves[256];
+	int scores[256];
+	int n_moves;
+	int next_idx;
+};
+
+// hash_move is handed out first if it's a legal move of the position, it can be PACKED_MOVE_NONE
+void init_move_picker(struct move_picker *picker, struct position *position, bool is_color_white, packed_move hash_move);
+
+// a picker for a search that orders the quiet moves
+// killers are the two quiet moves that last caused a beta cutoff at the same ply of the search, either can be PACKED_MOVE_NONE
+// previous_move is the move that led to the position, it picks the countermove, PACKED_MOVE_NONE at the root
+void init_ordered_move_picker(struct move_picker *picker, struct position *position, bool is_color_white, packed_move hash_move,
+                              const struct move_history *history, const packed_move killers[2], packed_move previous_move);
+
+// a picker that only hands out the noisy moves, captures, en passant and promotions, in the same order, for quiescence search
+void init_noisy_move_picker(struct move_picker *picker, struct position *position, bool is_color_white);
+
+// whether the color the picker was set up for is in check, gen.checkers is worked out by init_move_picker anyway
+static inline bool is_picker_in_check(const struct move_picker *picker) {
+	return picker->gen.checkers != 0;
+}
+
+// puts the next move into *into and returns true, returns false once every legal move has been handed out
+// the position must be the same as at init_move_picker every time, moves made on it in between have to be unmade first
+// is_check/is_mate of the moves are left false
+bool pick_next_move(struct move_picker *picker, struct move *into);
+
+// same as generate_moves_for_color with MOVE_GEN_NOISY_ONLY and MOVE_GEN_QUIET_ONLY respectively
+int generate_noisy_moves_for_color(struct position *position, struct move *into, bool is_color_white);
+int generate_quiet_moves_for_color(struct position *position, struct move *into, bool is_color_white);
+
+// same as generate_moves_for_color without any flags, but records the moves packed, into must hold up to 256 of them
+int generate_packed_moves_for_color(struct position *position, packed_move *into, bool is_color_white);
+
+packed_move pack_move(const struct move *move);
+
+// fills in *into from a packed move of the position, i.e. one whose piece is still on its source square
+// is_check/is_mate are left false
+void unpack_move(const struct position *position, packed_move packed, struct move *into);
+
+// returns whether the color has at least one legal move on the position, stopping as soon as one is found
+// a color with no legal moves is mated if its king is in check, otherwise stalemated
+bool has_any_legal_move(struct position *position, bool is_color_white);
+
+// sets is_check/is_mate of a legal move (or every move of a list) of the position
+void annotate_move(struct position *position, struct move *move);
+void annotate_moves(struct position *position, struct move *moves, int n_moves);
+
+void make_move(struct position *position, const struct move *move, struct undo_info *undo);
+
+void unmake_move(struct position *position, const struct move *move, const struct undo_info *undo);
+
+// make_move without an undo record, for when the move will never be taken back
+void apply_move_to_position(struct position *position, const struct move *move);
+
+// starts a game from the position of the fen, free_game_state releases the history's memory once the game isn't needed anymore
+void init_game_state(struct game_state *game_state, const char *fen);
+
+void free_game_state(struct game_state *game_state);
+
+void apply_move_to_game_state(struct game_state *game_state, const struct move *the_move);
+
+// returns how many times the game's latest position has occurred so far, counting the latest one itself
+// a capture or pawn move can never be undone, so only the positions since the last one are looked at, halfmove_clock of them at most
+int count_repetitions_of_last_position(const struct game_state *game_state);
+
+// rebuilds the position at ply, 0 to n_moves, by replaying the moves after the nearest checkpoint before it
+void get_game_position_at_ply(const struct game_state *game_state, int ply, struct position *into);
+
+// the move played at ply, 0 to n_moves - 1, with is_check/is_mate filled in
+void get_game_move_at_ply(const struct game_state *game_state, int ply, struct move *into);
\ No newline at end of file
@@ -21,9 +21,8 @@ static char *write_move_target_in_algebraic_notation_to_buf(const struct move *m
 }
 
 
-char *move_str(const struct move *move) {
-	static char move_str_buf[32];
-	char *to_write_to = move_str_buf;
+char *move_str(const struct move *move, char *buf) {
+	char *to_write_to = buf;
 
 	switch (move->piece_type) {
 		case PIECE_TYPE_PAWN: {
@@ -127,14 +126,13 @@ char *move_str(const struct move *move) {
 	
 	*to_write_to = 0;
 	
-	return move_str_buf;
+	return buf;
 }
 
 
 
-char *position_str(const struct position *position) {
-	static char position_str_buf[512];
-	char *to_write_to = position_str_buf;
+char *position_str(const struct position *position, char *buf) {
+	char *to_write_to = buf;
 
 	for (int rank = 7; rank >= 0; rank--) {
 		*to_write_to = rank + 1 + '0'; to_write_to++;
@@ -143,7 +141,7 @@ char *position_str(const struct position *position) {
 		*to_write_to = ' '; to_write_to++;
 
 		for (int file = 0; file < 8; file++) {
-			struct square square = position->squares[rank][file];
+			struct square square = get_square(position, rank, file);
 			
 			if (!square.has_piece) {
 				*to_write_to = ' '; to_write_to++;
@@ -185,15 +183,10 @@ char *position_str(const struct position *position) {
 
 	*to_write_to = 0;
 
-	return position_str_buf;
+	return buf;
 }
 
 void load_fen_to_position(const char *fen, struct position *into) {
-	into->white_king_rank = -1;
-	into->white_king_file = -1;
-	into->black_king_rank = -1;
-	into->black_king_file = -1;
-
 	for (int rank = 7; rank >= 0; rank--) {
 		for (int file = 0; file < 8; ) {
 			char ch = *fen;
@@ -202,50 +195,43 @@ void load_fen_to_position(const char *fen, struct position *into) {
 				int n_empty_squares = ch - '0';
 				
 				for (int empty_sq = 0; empty_sq < n_empty_squares; empty_sq++) {
-					into->squares[rank][file].has_piece = false;
+					set_square(into, rank, file, (struct square){0});
 					
 					file++;
 				}
 				
 			} else {
 					
-				struct square *current_square = &into->squares[rank][file];
+				struct square current_square;
 
-				current_square->has_piece = true;
+				current_square.has_piece = true;
 				
 				if (ch == 'p' || ch == 'n' || ch == 'b' || ch == 'r' || ch == 'q' || ch == 'k') {
-					current_square->is_piece_white = false;
+					current_square.is_piece_white = false;
 					ch -= 32;
 				} else {
-					current_square->is_piece_white = true;
+					current_square.is_piece_white = true;
 				}
 				
 				switch (ch) {
 				case 'P':
-				current_square->piece_type = PIECE_TYPE_PAWN; break;
+				current_square.piece_type = PIECE_TYPE_PAWN; break;
 				case 'N': 
-				current_square->piece_type = PIECE_TYPE_KNIGHT; break;
+				current_square.piece_type = PIECE_TYPE_KNIGHT; break;
 				case 'B': 
-				current_square->piece_type = PIECE_TYPE_BISHOP; break;
+				current_square.piece_type = PIECE_TYPE_BISHOP; break;
 				case 'R': 
-				current_square->piece_type = PIECE_TYPE_ROOK; break;
+				current_square.piece_type = PIECE_TYPE_ROOK; break;
 				case 'Q': 
-				current_square->piece_type = PIECE_TYPE_QUEEN; break;
-				case 'K': {
-					current_square->piece_type = PIECE_TYPE_KING; 
-					if (current_square->is_piece_white) {
-						into->white_king_rank = rank;
-						into->white_king_file = file;
-					} else {
-						into->black_king_rank = rank;
-						into->black_king_file = file;
-					}
-				} 
-				break;
+				current_square.piece_type = PIECE_TYPE_QUEEN; break;
+				case 'K': 
+				current_square.piece_type = PIECE_TYPE_KING; break;
 				default:
 					fprintf(stderr, "found invalid character '%c' in fen\n", ch);
 					exit(1);
 				}
+
+				set_square(into, rank, file, current_square);
 	
 				file++;
 				
@@ -264,25 +250,18 @@ void load_fen_to_position(const char *fen, struct position *into) {
 
 	} // rank loop
 
-	assert(into->white_king_rank != -1);
-	assert(into->white_king_file != -1);
-	assert(into->black_king_rank != -1);
-	assert(into->black_king_file != -1);
-
 	// whose turn is it portion of the fen
+	bool is_white_to_move = *fen == 'w';
 	fen += 2;
 
-	into->white_can_castle_kingside = false;
-	into->black_can_castle_kingside = false;
-	into->white_can_castle_queenside = false;
-	into->black_can_castle_queenside = false;
+	into->castling_rights = 0;
 	// read through the castling rights portion of the fen
 	while (*fen != ' ') {
 		switch (*fen) {
-			case 'K': into->white_can_castle_kingside = true; break;
-			case 'k': into->black_can_castle_kingside = true; break;
-			case 'Q': into->white_can_castle_queenside = true; break;
-			case 'q': into->black_can_castle_queenside = true; break;
+			case 'K': into->castling_rights |= CASTLE_WHITE_KINGSIDE; break;
+			case 'k': into->castling_rights |= CASTLE_BLACK_KINGSIDE; break;
+			case 'Q': into->castling_rights |= CASTLE_WHITE_QUEENSIDE; break;
+			case 'q': into->castling_rights |= CASTLE_BLACK_QUEENSIDE; break;
 			case '-': break;
 			default:
 				fprintf(stderr, "fen contains invalid character '%c' in castling rights portion\n", *fen);
@@ -293,10 +272,57 @@ void load_fen_to_position(const char *fen, struct position *into) {
 	}
 	fen++; // white space after castling portion of fen
 
-	memset(into->can_en_passant, 0, 8 * sizeof(into->can_en_passant[0]));
-	if (*fen != '-') {
-		char file_char = *fen;
-		int file_to_en_passant = file_char - 'a';
-		into->can_en_passant[file_to_en_passant] = true;
+	int fen_en_passant_file = NO_EN_PASSANT_FILE;
+	if (*fen != '-')
+		fen_en_passant_file = *fen - 'a';
+
+	// the halfmove clock and fullmove number, which some fens leave out
+	int halfmove_clock = 0;
+	int fullmove_number = 1;
+	while (*fen != ' ' && *fen != 0)
+		fen++;
+	if (*fen == ' ')
+		sscanf(fen, " %d %d", &halfmove_clock, &fullmove_number);
+	into->halfmove_clock = (uint16_t)halfmove_clock;
+	into->fullmove_number = (uint16_t)fullmove_number;
+
+	init_bitboards();
+	position_to_bitboard_position(into, &into->bitboards);
+	assert(bitboard_popcount(into->bitboards.pieces[COLOR_WHITE][PIECE_TYPE_KING]) == 1);
+	assert(bitboard_popcount(into->bitboards.pieces[COLOR_BLACK][PIECE_TYPE_KING]) == 1);
+	count_pieces(into);
+
+	// fens give the en passant square after every double push, it's only kept when make_move would have kept it
+	// the pawn that moved is the one of the side not to move, on its 4th rank
+	into->en_passant_file = NO_EN_PASSANT_FILE;
+	if (fen_en_passant_file != NO_EN_PASSANT_FILE) {
+		int pawn_square = SQUARE_INDEX(is_white_to_move ? 4 : 3, fen_en_passant_file);
+		if (can_pawn_be_captured_en_passant(into, pawn_square, !is_white_to_move))
+			into->en_passant_file = fen_en_passant_file;
+	}
+
+	into->hash = position_hash(into, is_white_to_move);
+}
+
+void load_fen_to_bitboard_position(const char *fen, struct bitboard_position *into) {
+	struct position position;
+	load_fen_to_position(fen, &position);
+	*into = position.bitboards;
+}
+
+bool is_white_to_move_in_fen(const char *fen) {
+	const char *side_to_move = strchr(fen, ' ');
+	if (side_to_move == NULL) {
+		fprintf(stderr, "fen '%s' has no side to move\n", fen);
+		exit(1);
+	}
+	side_to_move++;
+
+	switch (*side_to_move) {
+		case 'w': return true;
+		case 'b': return false;
+		default:
+			fprintf(stderr, "fen contains invalid side to move '%c'\n", *side_to_move);
+			exit(1);
 	}
-}
\ No newline at end of file
+}
@@ -1,8 +1,18 @@
 #pragma once
 
-// returns a string representing the move in algebraic notation
-char *move_str(const struct move *move);
+// large enough for any string move_str/position_str can write
+#define MOVE_STR_BUF_SIZE 32
+#define POSITION_STR_BUF_SIZE 512
 
-char *position_str(const struct position *position);
+// writes a string representing the move in algebraic notation into buf, which must hold MOVE_STR_BUF_SIZE chars, and returns buf
+char *move_str(const struct move *move, char *buf);
 
-void load_fen_to_position(const char *fen, struct position *into);
\ No newline at end of file
+// writes a diagram of the position into buf, which must hold POSITION_STR_BUF_SIZE chars, and returns buf
+char *position_str(const struct position *position, char *buf);
+
+void load_fen_to_position(const char *fen, struct position *into);
+
+void load_fen_to_bitboard_position(const char *fen, struct bitboard_position *into);
+
+// returns whether the side to move in the fen's second field is white, struct position doesn't record whose turn it is
+bool is_white_to_move_in_fen(const char *fen);
@@ -1,30 +1,542 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 
 #include "engine.h"
 #include "chess.h"
 #include "chess_utils.h"
+#include "platform.h"
 
-void init_engine(void) {
-	srand((unsigned int)(time(NULL)));
+
+// an entry's data is, from the lowest bits up:
+// 16 bits packed move, 16 bits score as a signed number, 8 bits depth, 2 bits BOUND_*, 6 bits age, 16 bits unused
+static uint64_t pack_transposition_data(packed_move move, int score, int depth, int bound, uint8_t age) {
+	return (uint64_t)move | ((uint64_t)(uint16_t)(int16_t)score << 16) | ((uint64_t)(uint8_t)depth << 32) |
+		((uint64_t)bound << 40) | ((uint64_t)(age & 63) << 42);
+}
+
+#define TRANSPOSITION_MOVE(data) ((packed_move)((data) & 0xFFFF))
+#define TRANSPOSITION_SCORE(data) ((int)(int16_t)(uint16_t)(((data) >> 16) & 0xFFFF))
+#define TRANSPOSITION_DEPTH(data) ((int)(((data) >> 32) & 0xFF))
+#define TRANSPOSITION_BOUND(data) ((int)(((data) >> 40) & 3))
+#define TRANSPOSITION_AGE(data) ((uint8_t)(((data) >> 42) & 63))
+
+// mate scores count the plies from the root, but the table is shared between positions at different plies
+// so they are stored counting from the position itself and converted back when read
+static int score_to_table(int score, int ply) {
+	if (score > MATE_SCORE - MAX_SEARCH_PLY)
+		return score + ply;
+	if (score < -(MATE_SCORE - MAX_SEARCH_PLY))
+		return score - ply;
+	return score;
+}
+
+static int score_from_table(int score, int ply) {
+	if (score > MATE_SCORE - MAX_SEARCH_PLY)
+		return score - ply;
+	if (score < -(MATE_SCORE - MAX_SEARCH_PLY))
+		return score + ply;
+	return score;
+}
+
+// returns whether the table has an entry for hash, with its data in *data
+static bool probe_transposition_table(const struct transposition_table *table, uint64_t hash, uint64_t *data) {
+	if (!has_hash_table_entries(&table->buckets))
+		return false;
+
+	const struct hash_entry *bucket = hash_table_bucket(&table->buckets, hash);
+	for (int i = 0; i < TRANSPOSITION_BUCKET_SIZE; i++) {
+		if (read_hash_entry(&bucket[i], hash, data))
+			return true;
+	}
+	return false;
+}
+
+// overwrites the bucket's entry for the same position if there is one, otherwise the one least worth keeping:
+// the shallowest, with every search it has sat through since it was stored counting as much as a few plies less depth
+static void store_transposition_table(struct transposition_table *table, uint64_t hash, packed_move move, int score, int depth, int bound) {
+	if (!has_hash_table_entries(&table->buckets))
+		return;
+
+	struct hash_entry *bucket = hash_table_bucket(&table->buckets, hash);
+	struct hash_entry *replaced = NULL;
+	int replaced_worth = 0;
+
+	for (int i = 0; i < TRANSPOSITION_BUCKET_SIZE; i++) {
+		uint64_t entry_data;
+		if (read_hash_entry(&bucket[i], hash, &entry_data)) {
+			// a search that didn't find a best move, i.e. failed low, keeps the move found for the position before
+			if (move == PACKED_MOVE_NONE)
+				move = TRANSPOSITION_MOVE(entry_data);
+			replaced = &bucket[i];
+			break;
+		}
+
+		int age_difference = (table->age - TRANSPOSITION_AGE(entry_data)) & 63;
+		int worth = TRANSPOSITION_DEPTH(entry_data) - 4 * age_difference;
+		if (replaced == NULL || worth < replaced_worth) {
+			replaced = &bucket[i];
+			replaced_worth = worth;
+		}
+	}
+
+	write_hash_entry(replaced, hash, pack_transposition_data(move, score, depth, bound, table->age));
 }
 
-struct move find_best_move_for_color(struct position *the_position, bool is_piece_white) {
-	struct move all_legal_moves[256];
-	
-	int n_legal_moves = find_all_possible_moves_for_color(the_position, all_legal_moves, is_piece_white);
-	
+void init_engine(struct engine *engine, int hash_megabytes, int n_threads) {
+	memset(engine, 0, sizeof(*engine));
+
+	engine->limits.max_depth = MAX_SEARCH_PLY;
+	engine->limits.max_nodes = 0;
+	engine->limits.max_seconds = 1.0;
+
+	init_hash_table(&engine->table.buckets, hash_megabytes, TRANSPOSITION_BUCKET_SIZE);
+	engine->table.age = 0;
+
+	engine->n_threads = n_threads > 0 ? n_threads : hardware_thread_count();
+	engine->threads = calloc((size_t)engine->n_threads, sizeof(struct search_thread));
+	if (engine->threads == NULL) {
+		fprintf(stderr, "couldn't allocate the state of %d search threads\n", engine->n_threads);
+		exit(1);
+	}
+	for (int i = 0; i < engine->n_threads; i++) {
+		engine->threads[i].engine = engine;
+		engine->threads[i].thread_idx = i;
+	}
+
+	init_bitboards();
+}
+
+void free_engine(struct engine *engine) {
+	free_hash_table(&engine->table.buckets);
+
+	free(engine->threads);
+	engine->threads = NULL;
+	engine->n_threads = 0;
+}
+
+// bonus for standing closer to the middle of the board, where a knight, bishop or queen reaches the most squares
+static const int centralization_bonus[64] = {
+	-20, -10, -10, -10, -10, -10, -10, -20,
+	-10,   0,   0,   0,   0,   0,   0, -10,
+	-10,   0,   5,  10,  10,   5,   0, -10,
+	-10,   5,  10,  15,  15,  10,   5, -10,
+	-10,   5,  10,  15,  15,  10,   5, -10,
+	-10,   0,   5,  10,  10,   5,   0, -10,
+	-10,   0,   0,   0,   0,   0,   0, -10,
+	-20, -10, -10, -10, -10, -10, -10, -20,
+};
+
+// bonus for a pawn by how many ranks it has advanced from its own side's point of view, it gets closer to promoting
+static const int pawn_advancement_bonus[8] = { 0, 0, 5, 10, 20, 35, 60, 0 };
+
+// the position's score for white, material plus a few positional terms
+static int evaluate_for_white(const struct position *position) {
+	const struct bitboard_position *bitboards = &position->bitboards;
+	int score = position->material[COLOR_WHITE] - position->material[COLOR_BLACK];
+
+	for (int color = COLOR_WHITE; color <= COLOR_BLACK; color++) {
+		int sign = color == COLOR_WHITE ? 1 : -1;
+
+		bitboard pieces = bitboards->pieces[color][PIECE_TYPE_KNIGHT] | bitboards->pieces[color][PIECE_TYPE_BISHOP] | bitboards->pieces[color][PIECE_TYPE_QUEEN];
+		while (pieces)
+			score += sign * centralization_bonus[bitboard_pop_lsb(&pieces)];
+
+		bitboard pawns = bitboards->pieces[color][PIECE_TYPE_PAWN];
+		while (pawns) {
+			int rank = SQUARE_RANK(bitboard_pop_lsb(&pawns));
+			score += sign * pawn_advancement_bonus[color == COLOR_WHITE ? rank : 7 - rank];
+		}
+	}
+
+	return score;
+}
+
+static int evaluate(const struct position *position, bool is_white_to_move) {
+	int score = evaluate_for_white(position);
+	return is_white_to_move ? score : -score;
+}
+
+static uint64_t count_nodes_of_all_threads(const struct engine *engine) {
+	uint64_t n_nodes = 0;
+	for (int i = 0; i < engine->n_threads; i++)
+		n_nodes += engine->threads[i].nodes;
+	return n_nodes;
+}
+
+// counts a node and returns whether the search has to stop
+// only the main thread checks the limits, every 1024 nodes, the helpers stop when the main thread tells them to
+static bool count_node_and_check_limits(struct search_thread *thread) {
+	thread->nodes++;
+	if (thread->is_stopped)
+		return true;
+
+	struct engine *engine = thread->engine;
+	if (thread->thread_idx != 0) {
+		if (engine->stop_helpers)
+			thread->is_stopped = true;
+		return thread->is_stopped;
+	}
+
+	if (!thread->can_stop || (thread->nodes & 1023) != 0)
+		return false;
+
+	const struct search_limits *limits = &engine->search_limits;
+	if (limits->max_nodes != 0 && count_nodes_of_all_threads(engine) >= limits->max_nodes)
+		thread->is_stopped = true;
+	else if (limits->max_seconds > 0 && wall_clock_seconds() - engine->start_time >= limits->max_seconds)
+		thread->is_stopped = true;
+
+	return thread->is_stopped;
+}
+
+// whether the position at ply is a draw by the fifty move rule or by repeating a position since the search's root
+// a single repetition is scored as a draw, if it was worth repeating once it's worth repeating again
+static bool is_draw_in_search(const struct search_thread *thread, struct position *position, bool is_white_to_move, int ply) {
+	// the move that reached the limit can still have mated, and a mate counts over the fifty move rule
+	if (position->halfmove_clock >= 100) {
+		if (has_any_legal_move(position, is_white_to_move))
+			return true;
+		int king_square = bitboard_lsb(position->bitboards.pieces[COLOR_INDEX(is_white_to_move)][PIECE_TYPE_KING]);
+		return !is_square_attacked_by_piece_of_color(position, SQUARE_RANK(king_square), SQUARE_FILE(king_square), !is_white_to_move);
+	}
+
+	// a capture or pawn move can never be undone, only the positions after the last one can repeat, and only with the same side to move
+	int oldest_ply = ply - position->halfmove_clock;
+	for (int earlier_ply = ply - 4; earlier_ply >= 0 && earlier_ply >= oldest_ply; earlier_ply -= 2) {
+		if (thread->path_hashes[earlier_ply] == position->hash)
+			return true;
+	}
+	return false;
+}
+
+// sets the principal variation at ply to move followed by the one found at ply + 1
+static void update_pv(struct search_thread *thread, int ply, packed_move move) {
+	thread->pv[ply][0] = move;
+	int child_length = ply + 1 < MAX_SEARCH_PLY ? thread->pv_length[ply + 1] : 0;
+	for (int i = 0; i < child_length && i + 1 < MAX_SEARCH_PLY; i++)
+		thread->pv[ply][i + 1] = thread->pv[ply + 1][i];
+	thread->pv_length[ply] = child_length + 1 < MAX_SEARCH_PLY ? child_length + 1 : MAX_SEARCH_PLY;
+}
+
+// history scores stay within plus or minus this
+#define MAX_HISTORY 16384
+
+// moves a history score by bonus, less the closer it already is to MAX_HISTORY in that direction
+// so scores never leave the range, and a move that stops causing cutoffs loses its place quickly
+static void update_history_score(int16_t *score, int bonus) {
+	*score = (int16_t)(*score + bonus - *score * abs(bonus) / MAX_HISTORY);
+}
+
+// records that the quiet move caused a beta cutoff at ply after the quiet moves in tried_quiets failed to
+static void update_quiet_move_ordering(struct search_thread *thread, const struct position *position, bool is_white_to_move, int depth, int ply,
+                                       packed_move move, const packed_move *tried_quiets, int n_tried_quiets) {
+	if (thread->killers[ply][0] != move) {
+		thread->killers[ply][1] = thread->killers[ply][0];
+		thread->killers[ply][0] = move;
+	}
+
+	// a cutoff deeper in the tree refutes more, but a single deep one shouldn't wipe out everything else that was learned
+	int bonus = depth * depth < MAX_HISTORY / 16 ? depth * depth : MAX_HISTORY / 16;
+	int16_t (*butterfly)[64] = thread->history.butterfly[COLOR_INDEX(is_white_to_move)];
+	update_history_score(&butterfly[PACKED_MOVE_SOURCE(move)][PACKED_MOVE_TARGET(move)], bonus);
+	for (int i = 0; i < n_tried_quiets; i++)
+		update_history_score(&butterfly[PACKED_MOVE_SOURCE(tried_quiets[i])][PACKED_MOVE_TARGET(tried_quiets[i])], -bonus);
+
+	if (ply > 0) {
+		int previous_target = PACKED_MOVE_TARGET(thread->played_moves[ply - 1]);
+		thread->history.countermoves[position->board[previous_target]][previous_target] = move;
+	}
+}
+
+// searches only the noisy moves at the leaves, so the score isn't taken in the middle of an exchange
+// the side to move can stand pat, i.e. take the static evaluation, instead of capturing, unless it's in check
+static int quiescence_search(struct search_thread *thread, struct position *position, bool is_white_to_move, int ply, int alpha, int beta) {
+	thread->pv_length[ply] = 0;
+	if (count_node_and_check_limits(thread))
+		return 0;
+
+	if (ply >= MAX_SEARCH_PLY - 1)
+		return evaluate(position, is_white_to_move);
+
+	struct move_picker picker;
+	init_noisy_move_picker(&picker, position, is_white_to_move);
+	bool is_in_check = is_picker_in_check(&picker);
+
+	// in check, every move has to be looked at, there's no standing pat and no legal move means mate
+	if (is_in_check) {
+		init_move_picker(&picker, position, is_white_to_move, PACKED_MOVE_NONE);
+	} else {
+		int stand_pat = evaluate(position, is_white_to_move);
+		if (stand_pat >= beta)
+			return stand_pat;
+		if (stand_pat > alpha)
+			alpha = stand_pat;
+	}
+
+	int best_score = is_in_check ? -INFINITE_SCORE : alpha;
+	bool has_legal_move = false;
+
+	struct move move;
+	while (pick_next_move(&picker, &move)) {
+		has_legal_move = true;
+
+		// a capture that loses material on its square can't be better than standing pat
+		if (!is_in_check && see(position, &move) < 0)
+			continue;
+
+		struct undo_info undo;
+		make_move(position, &move, &undo);
+		int score = -quiescence_search(thread, position, !is_white_to_move, ply + 1, -beta, -alpha);
+		unmake_move(position, &move, &undo);
+
+		if (thread->is_stopped)
+			return 0;
+
+		if (score > best_score) {
+			best_score = score;
+			if (score > alpha) {
+				alpha = score;
+				update_pv(thread, ply, pack_move(&move));
+				if (score >= beta)
+					break;
+			}
+		}
+	}
+
+	if (is_in_check && !has_legal_move)
+		return -MATE_SCORE + ply;
+
+	return best_score;
+}
+
+// negamax alpha-beta with principal variation search, returns the score of the position for the side to move
+// scores at or below alpha only say the real score is no higher, scores at or above beta only that it's no lower
+static int search(struct search_thread *thread, struct position *position, bool is_white_to_move, int depth, int ply, int alpha, int beta) {
+	thread->pv_length[ply] = 0;
+	thread->path_hashes[ply] = position->hash;
+
+	if (ply > 0 && is_draw_in_search(thread, position, is_white_to_move, ply))
+		return 0;
+
+	if (depth <= 0)
+		return quiescence_search(thread, position, is_white_to_move, ply, alpha, beta);
+
+	if (count_node_and_check_limits(thread))
+		return 0;
+
+	if (ply >= MAX_SEARCH_PLY - 1)
+		return evaluate(position, is_white_to_move);
+
+	// a null window can't hold a principal variation, the table's score is only taken as is outside of one
+	// so a principal variation is always searched all the way through and comes out whole
+	bool is_pv_node = beta - alpha > 1;
+
+	packed_move table_move = PACKED_MOVE_NONE;
+	uint64_t table_data;
+	if (probe_transposition_table(&thread->engine->table, position->hash, &table_data)) {
+		table_move = TRANSPOSITION_MOVE(table_data);
+
+		int table_score = score_from_table(TRANSPOSITION_SCORE(table_data), ply);
+		int table_bound = TRANSPOSITION_BOUND(table_data);
+		if (!is_pv_node && TRANSPOSITION_DEPTH(table_data) >= depth) {
+			if (table_bound == BOUND_EXACT ||
+					(table_bound == BOUND_LOWER && table_score >= beta) ||
+					(table_bound == BOUND_UPPER && table_score <= alpha))
+				return table_score;
+		}
+	}
+
+	// along the previous iteration's principal variation its moves are searched first, they are the best guesses there are
+	// elsewhere the best move found the last time the position was searched is
+	packed_move pv_move = PACKED_MOVE_NONE;
+	if (thread->is_following_pv && ply < thread->previous_pv_length)
+		pv_move = thread->previous_pv[ply];
+
+	packed_move previous_move = ply > 0 ? thread->played_moves[ply - 1] : PACKED_MOVE_NONE;
+	struct move_picker picker;
+	init_ordered_move_picker(&picker, position, is_white_to_move, pv_move != PACKED_MOVE_NONE ? pv_move : table_move, &thread->history, thread->killers[ply], previous_move);
+	bool is_in_check = is_picker_in_check(&picker);
+
+	int original_alpha = alpha;
+	int best_score = -INFINITE_SCORE;
+	packed_move best_move = PACKED_MOVE_NONE;
+	int n_searched = 0;
+
+	// the quiet moves searched so far, their history goes down if a later quiet move causes the cutoff
+	packed_move tried_quiets[256];
+	int n_tried_quiets = 0;
+
+	struct move move;
+	while (pick_next_move(&picker, &move)) {
+		packed_move packed = pack_move(&move);
+		if (packed != pv_move)
+			thread->is_following_pv = false;
+
+		bool is_quiet = !is_packed_move_noisy(position, packed);
+		thread->played_moves[ply] = packed;
+
+		struct undo_info undo;
+		make_move(position, &move, &undo);
+
+		// the first move gets the full window, the rest are only proven not to be better with a null window around alpha
+		// and searched again with the full window if that fails
+		int score;
+		if (n_searched == 0) {
+			score = -search(thread, position, !is_white_to_move, depth - 1, ply + 1, -beta, -alpha);
+		} else {
+			score = -search(thread, position, !is_white_to_move, depth - 1, ply + 1, -alpha - 1, -alpha);
+			if (score > alpha && score < beta)
+				score = -search(thread, position, !is_white_to_move, depth - 1, ply + 1, -beta, -alpha);
+		}
+
+		unmake_move(position, &move, &undo);
+		n_searched++;
+
+		// the moves after the principal variation's own aren't on it anymore
+		thread->is_following_pv = false;
+
+		if (thread->is_stopped)
+			return 0;
+
+		if (score > best_score) {
+			best_score = score;
+			if (score > alpha) {
+				alpha = score;
+				best_move = packed;
+				update_pv(thread, ply, packed);
+				if (score >= beta) {
+					if (is_quiet)
+						update_quiet_move_ordering(thread, position, is_white_to_move, depth, ply, packed, tried_quiets, n_tried_quiets);
+					break;
+				}
+			}
+		}
+
+		if (is_quiet)
+			tried_quiets[n_tried_quiets++] = packed;
+	}
+
+	if (n_searched == 0)
+		return is_in_check ? -MATE_SCORE + ply : 0;
+
+	int bound = best_score >= beta ? BOUND_LOWER : best_score > original_alpha ? BOUND_EXACT : BOUND_UPPER;
+	store_transposition_table(&thread->engine->table, position->hash, best_move, score_to_table(best_score, ply), depth, bound);
+
+	return best_score;
+}
+
+// iterative deepening, one search per depth, each one starting with what the shallower ones left in the transposition table
+// the helpers vary the depths, odd helpers start a ply deeper, and don't follow the previous principal variation
+// so they branch off the main thread's tree instead of searching it again move for move, the only thing they return is the
+// table entries they leave behind
+static void iterative_deepening(struct search_thread *thread, int max_depth) {
+	struct engine *engine = thread->engine;
+	bool is_helper = thread->thread_idx != 0;
+
+	for (int depth = 1 + (is_helper ? thread->thread_idx % 2 : 0); depth <= max_depth; depth++) {
+		thread->is_following_pv = !is_helper;
+		int score = search(thread, &thread->position, thread->is_white_to_move, depth, 0, -INFINITE_SCORE, INFINITE_SCORE);
+
+		// an unfinished iteration's result is thrown away, it may not have looked at the move that refutes its best guess
+		if (thread->is_stopped)
+			break;
+
+		thread->score = score;
+		thread->completed_depth = depth;
+		thread->previous_pv_length = thread->pv_length[0];
+		memcpy(thread->previous_pv, thread->pv[0], thread->pv_length[0] * sizeof(thread->pv[0][0]));
+
+		// only the first iteration is guaranteed to finish
+		thread->can_stop = true;
+
+		if (is_helper)
+			continue;
+
+		// a forced mate found within the depth searched won't get any shorter by searching deeper
+		if (IS_MATE_SCORE(score) && MATE_SCORE - abs(score) <= depth)
+			break;
+		if (engine->search_limits.max_seconds > 0 && wall_clock_seconds() - engine->start_time >= engine->search_limits.max_seconds)
+			break;
+	}
+}
+
+static void run_helper(void *thread_pointer) {
+	struct search_thread *thread = thread_pointer;
+	iterative_deepening(thread, thread->engine->max_depth);
+}
+
+void search_position(struct engine *engine, struct position *position, bool is_white_to_move, const struct search_limits *limits, struct search_result *result) {
 	// this function should not have been called if the engine doesn't have a best move to give
 	// having 0 legal moves means the game is over and the engine is mated
-	assert(n_legal_moves > 0); 
-	
-	int best_move_idx = rand() % n_legal_moves;
-	
-	struct move engine_move = all_legal_moves[best_move_idx];
-	
-	fprintf(stderr, "%d legal moves for engine, chose move %d\n", n_legal_moves, best_move_idx);
-
-	return engine_move;
-}
\ No newline at end of file
+	assert(has_any_legal_move(position, is_white_to_move));
+
+	engine->search_limits = *limits;
+	engine->start_time = wall_clock_seconds();
+	engine->stop_helpers = 0;
+	engine->table.age = (engine->table.age + 1) & 63;
+
+	for (int i = 0; i < engine->n_threads; i++) {
+		struct search_thread *thread = &engine->threads[i];
+		thread->position = *position;
+		thread->is_white_to_move = is_white_to_move;
+		thread->nodes = 0;
+		thread->can_stop = false;
+		thread->is_stopped = false;
+		thread->previous_pv_length = 0;
+		thread->completed_depth = 0;
+
+		// killers are only good for the positions of one search, the history is kept but counts for less with every search
+		memset(thread->killers, 0, sizeof(thread->killers));
+		for (int color = 0; color < 2; color++) {
+			for (int source = 0; source < 64; source++) {
+				for (int target = 0; target < 64; target++)
+					thread->history.butterfly[color][source][target] /= 2;
+			}
+		}
+	}
+
+	engine->max_depth = limits->max_depth > 0 && limits->max_depth < MAX_SEARCH_PLY ? limits->max_depth : MAX_SEARCH_PLY - 1;
+
+	struct thread_pool *pool = get_shared_thread_pool();
+	for (int i = 1; i < engine->n_threads; i++)
+		submit_task(pool, &engine->helpers, run_helper, &engine->threads[i]);
+
+	struct search_thread *main_thread = &engine->threads[0];
+	iterative_deepening(main_thread, engine->max_depth);
+
+	// a plain store is enough, the helpers only ever read the flag and waiting for them below waits for them to see it
+	engine->stop_helpers = 1;
+	wait_for_task_group(pool, &engine->helpers);
+
+	memset(result, 0, sizeof(*result));
+	result->score = main_thread->score;
+	result->depth = main_thread->completed_depth;
+
+	// the packed principal variation is turned into full moves by playing it out on a copy of the position
+	struct position pv_position = *position;
+	for (int i = 0; i < main_thread->previous_pv_length; i++) {
+		unpack_move(&pv_position, main_thread->previous_pv[i], &result->pv[i]);
+		apply_move_to_position(&pv_position, &result->pv[i]);
+	}
+	result->pv_length = main_thread->previous_pv_length;
+	assert(result->pv_length > 0);
+
+	result->best_move = result->pv[0];
+	result->nodes = count_nodes_of_all_threads(engine);
+	result->seconds = wall_clock_seconds() - engine->start_time;
+}
+
+struct move find_best_move_for_color(struct engine *engine, struct position *the_position, bool is_piece_white) {
+	struct search_result result;
+	search_position(engine, the_position, is_piece_white, &engine->limits, &result);
+
+	char move_str_buf[MOVE_STR_BUF_SIZE];
+	fprintf(stderr, "depth %d, score %d, nodes %llu, time %.3fs, pv", result.depth, result.score, (unsigned long long)result.nodes, result.seconds);
+	for (int i = 0; i < result.pv_length; i++)
+		fprintf(stderr, " %s", move_str(&result.pv[i], move_str_buf));
+	fprintf(stderr, "\n");
+
+	return result.best_move;
+}
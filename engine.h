@@ -1,7 +1,132 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "chess.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "hash_table.h"
+
+// the deepest a search goes, counting the plies of the quiescence search at its leaves
+#define MAX_SEARCH_PLY 64
+
+// scores are in centipawns from the point of view of the side to move
+// being mated in n plies scores -(MATE_SCORE - n), mating in n plies MATE_SCORE - n
+#define MATE_SCORE 30000
+#define INFINITE_SCORE 32000
+
+// a score this close to MATE_SCORE is a forced mate rather than a material count
+#define IS_MATE_SCORE(score) ((score) > MATE_SCORE - MAX_SEARCH_PLY || (score) < -(MATE_SCORE - MAX_SEARCH_PLY))
+
+// when a search has to stop, 0 means no limit of that kind
+// the search deepens one ply at a time and once it stops, it returns what the last iteration it finished found
+// the first iteration always finishes, so there is always a move to return
+struct search_limits {
+	int max_depth;          // in plies, at most MAX_SEARCH_PLY
+	uint64_t max_nodes;     // counted over all threads, checked every 1024 nodes
+	double max_seconds;
+};
+
+struct search_result {
+	struct move best_move;
+	int score;
+	int depth;              // of the last iteration that finished
+	uint64_t nodes;         // searched by all threads over all iterations, including the unfinished last one
+	double seconds;
+
+	// the principal variation, the moves both sides are expected to play starting with best_move
+	struct move pv[MAX_SEARCH_PLY];
+	int pv_length;
+};
+
+// what kind of bound a transposition table score is
+#define BOUND_NONE 0
+#define BOUND_UPPER 1    // the search failed low, the real score is at most this
+#define BOUND_LOWER 2    // the search failed high, the real score is at least this
+#define BOUND_EXACT 3
+
+// entries are grouped in buckets of this many, one cache line's worth
+#define TRANSPOSITION_BUCKET_SIZE 4
+
+// the results of searching positions, remembered by their hash so searching one again along another move order or in a later
+// search can start from there, the data of an entry is packed by pack_transposition_data in engine.c
+struct transposition_table {
+	struct hash_table buckets;
+	uint8_t age;                // goes up with every search, entries left from older searches are the first replaced
+};
+
+struct engine;
+
+// the state of one thread's search, the engine has one of these per thread
+// thread 0 is the main thread, which runs in the caller of search_position and is the one whose result is returned
+// the others are helpers, tasks of the shared thread pool that search the same position at the same time only to fill the
+// shared transposition table, a helper the pool has no thread free for only starts once the main thread waits for it, and stops right away
+struct search_thread {
+	struct engine *engine;
+	int thread_idx;
+
+	// the thread's own copy of the position being searched, moves are made and unmade on it
+	struct position position;
+	bool is_white_to_move;
+
+	volatile uint64_t nodes;    // read by the main thread to check the node limit
+	bool can_stop;              // false during the main thread's first iteration
+	bool is_stopped;            // set once the search has to stop, everything searched after that is thrown away
+
+	// hashes of the positions from the root to the current ply, to find repetitions within the search
+	uint64_t path_hashes[MAX_SEARCH_PLY + 1];
+
+	// pv[ply] is the principal variation found from ply on, pv_length[ply] moves of it
+	packed_move pv[MAX_SEARCH_PLY][MAX_SEARCH_PLY];
+	int pv_length[MAX_SEARCH_PLY];
+
+	// the principal variation of the last finished iteration, searched first by the next one while the search follows it
+	packed_move previous_pv[MAX_SEARCH_PLY];
+	int previous_pv_length;
+	bool is_following_pv;
+
+	// move ordering, learned from the beta cutoffs of this thread's search
+	// killers[ply] are the two quiet moves that last caused a cutoff at ply, the most recent first
+	packed_move killers[MAX_SEARCH_PLY][2];
+	struct move_history history;
+
+	// played_moves[ply] is the move being searched at ply, so the ply after it knows which move it has to answer
+	packed_move played_moves[MAX_SEARCH_PLY];
+
+	int completed_depth;        // of the last iteration that finished
+	int score;                  // and its score
+};
+
+// everything an engine instance keeps between calls
+// an engine searches with n_threads threads, but can itself only be used by one thread at a time
+struct engine {
+	// the limits find_best_move_for_color searches with, init_engine sets them to a second per move
+	struct search_limits limits;
+
+	// kept from one search to the next, so the next move's search already knows most of the positions it runs into
+	// shared by all the threads, see struct hash_entry in hash_table.h for how that works without locks
+	struct transposition_table table;
+
+	int n_threads;
+	struct search_thread *threads;
+
+	// the search in progress
+	struct search_limits search_limits;
+	int max_depth;                   // search_limits.max_depth, or as deep as a search can go when that has no limit
+	double start_time;
+	volatile int32_t stop_helpers;   // set by the main thread when it's done, the helpers stop as soon as they see it
+	struct task_group helpers;
+};
+
+// hash_megabytes is the most memory the transposition table can take, it has no entries at all with 0
+// n_threads is the number of threads every search runs on, 0 for as many as the machine can run at once
+void init_engine(struct engine *engine, int hash_megabytes, int n_threads);
+
+void free_engine(struct engine *engine);
 
-void init_engine(void);
+// searches the position for the best move of the side to move, deepening until a limit in *limits is hit
+// the side to move must have at least one legal move, position is left as it was
+void search_position(struct engine *engine, struct position *position, bool is_white_to_move, const struct search_limits *limits, struct search_result *result);
 
-struct move find_best_move_for_color(struct position *the_position, bool is_piece_white);
\ No newline at end of file
+// search_position with engine->limits, returns only the best move
+struct move find_best_move_for_color(struct engine *engine, struct position *the_position, bool is_piece_white);
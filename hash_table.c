@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "hash_table.h"
+
+#define CACHE_LINE_BYTES 64
+
+void init_hash_table(struct hash_table *table, int megabytes, int bucket_size) {
+	assert(bucket_size >= 1);
+
+	table->entries = NULL;
+	table->allocation = NULL;
+	table->bucket_mask = 0;
+	table->bucket_size = bucket_size;
+	if (megabytes <= 0)
+		return;
+
+	size_t bucket_bytes = bucket_size * sizeof(struct hash_entry);
+	uint64_t max_buckets = (uint64_t)megabytes * 1024 * 1024 / bucket_bytes;
+	uint64_t n_buckets = 1;
+	while (n_buckets * 2 <= max_buckets)
+		n_buckets *= 2;
+
+	// one more cache line's worth so the entries can start on a cache line boundary, which calloc doesn't promise
+	// with buckets of a cache line or a power of 2 fraction of one, no bucket then straddles two lines
+	table->allocation = calloc((size_t)n_buckets * bucket_bytes + CACHE_LINE_BYTES, 1);
+	if (table->allocation == NULL) {
+		fprintf(stderr, "couldn't allocate a %d MB hash table\n", megabytes);
+		exit(1);
+	}
+	uintptr_t aligned = ((uintptr_t)table->allocation + CACHE_LINE_BYTES - 1) & ~(uintptr_t)(CACHE_LINE_BYTES - 1);
+	table->entries = (struct hash_entry *)aligned;
+	table->bucket_mask = n_buckets - 1;
+}
+
+void free_hash_table(struct hash_table *table) {
+	free(table->allocation);
+	table->allocation = NULL;
+	table->entries = NULL;
+	table->bucket_mask = 0;
+}
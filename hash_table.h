@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// a table of 64 bits of data per position, keyed by the position's hash, that any number of threads read and write at once
+// the transposition table of the engine and perft's table of counts are both built on it, each packing its own data
+//
+// threads read and write entries without locks, so an entry can end up with check from one write and data from another
+// check is the position's hash xored with data, which only matches when both halves come from the same write
+struct hash_entry {
+	volatile uint64_t check;
+	volatile uint64_t data;
+};
+
+// entries are grouped in buckets of bucket_size, a position can be stored in any entry of the bucket its hash picks
+struct hash_table {
+	struct hash_entry *entries;    // aligned to the start of a cache line
+	void *allocation;              // what entries was carved out of, for freeing it
+	uint64_t bucket_mask;          // the number of buckets is a power of 2, the low bits of the hash pick the bucket
+	int bucket_size;
+};
+
+// sets up a table using at most megabytes of memory, with no entries when megabytes is 0
+void init_hash_table(struct hash_table *table, int megabytes, int bucket_size);
+
+void free_hash_table(struct hash_table *table);
+
+static inline bool has_hash_table_entries(const struct hash_table *table) {
+	return table->entries != NULL;
+}
+
+// the first entry of the bucket of hash, the table must have entries
+static inline struct hash_entry *hash_table_bucket(const struct hash_table *table, uint64_t hash) {
+	return &table->entries[(hash & table->bucket_mask) * (uint64_t)table->bucket_size];
+}
+
+// puts the entry's data into *data and returns whether it was stored for hash, in a single write
+static inline bool read_hash_entry(const struct hash_entry *entry, uint64_t hash, uint64_t *data) {
+	uint64_t check = entry->check;
+	*data = entry->data;
+	return (check ^ *data) == hash;
+}
+
+static inline void write_hash_entry(struct hash_entry *entry, uint64_t hash, uint64_t data) {
+	entry->check = hash ^ data;
+	entry->data = data;
+}
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chess.h"
+#include "chess_utils.h"
+#include "platform.h"
+#include "thread_pool.h"
+#include "hash_table.h"
+
+// usage:
+//   perft [options]                                 runs the positions below and checks every count, as a move generation benchmark
+//   perft [options] "<fen>" <depth> [expected]      prints the leaf count under every root move (divide), the total, time and nps
+//                                                   if expected is given, exits with 1 when the total doesn't match it
+// options:
+//   -threads <n>    number of threads to count with, defaults to every hardware thread
+//   -split <d>      the subtrees below every move sequence of d plies from the root are what the threads divide between them,
+//                   defaults to 2, more gives smaller pieces of work that balance better over many threads
+//   -hash <mb>      memory for the table of counts already known, shared by all threads, defaults to 64
+//                   0 turns it off, which is what measures the raw speed of move generation
+
+struct perft_test {
+	const char *name;
+	const char *fen;
+	int depth;
+	uint64_t expected_nodes;
+};
+
+// the usual reference positions, with counts that are widely published
+static const struct perft_test perft_tests[] = {
+	{ "starting position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609 },
+	{ "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603 },
+	{ "rook endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083 },
+	{ "promotions", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333 },
+	{ "discovered checks", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487 },
+	{ "middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594 },
+};
+
+// the table of counts already known is a hash table with buckets of one entry
+// an entry's data is the count shifted up by 8 bits, with the depth in the low 8 bits, and it's always replaced
+static bool probe_perft_table(const struct hash_table *table, uint64_t hash, int depth, uint64_t *n_nodes) {
+	uint64_t data;
+	if (!read_hash_entry(hash_table_bucket(table, hash), hash, &data) || (int)(data & 0xFF) != depth)
+		return false;
+
+	*n_nodes = data >> 8;
+	return true;
+}
+
+static void store_perft_table(struct hash_table *table, uint64_t hash, int depth, uint64_t n_nodes) {
+	write_hash_entry(hash_table_bucket(table, hash), hash, (n_nodes << 8) | (uint64_t)depth);
+}
+
+// returns the number of leaf positions depth plies below position, with the color to move being is_color_white
+// table is only used if it has entries, and only for depth 2 and up, depth 1 is just the number of legal moves
+static uint64_t perft(struct position *position, int depth, bool is_color_white, struct hash_table *table) {
+	if (depth == 0)
+		return 1;
+
+	// the leaves are the legal moves themselves, they don't need to be recorded or played
+	if (depth == 1)
+		return generate_moves_for_color(position, NULL, is_color_white, 0);
+
+	bool is_table_used = has_hash_table_entries(table);
+	uint64_t hash = 0;
+	if (is_table_used) {
+		hash = position->hash;
+
+		uint64_t n_nodes;
+		if (probe_perft_table(table, hash, depth, &n_nodes))
+			return n_nodes;
+	}
+
+	struct move moves[256];
+	int n_moves = generate_moves_for_color(position, moves, is_color_white, 0);
+
+	uint64_t n_nodes = 0;
+	for (int i = 0; i < n_moves; i++) {
+		struct undo_info undo;
+		make_move(position, &moves[i], &undo);
+		n_nodes += perft(position, depth - 1, !is_color_white, table);
+		unmake_move(position, &moves[i], &undo);
+	}
+
+	if (is_table_used)
+		store_perft_table(table, hash, depth, n_nodes);
+
+	return n_nodes;
+}
+
+// the most plies a work item's path can hold, i.e. the largest -split
+#define MAX_SPLIT_DEPTH 8
+
+struct perft_job;
+
+// one subtree to count, reached by playing path from the root position, counted by a task of its own
+struct perft_work_item {
+	struct perft_job *job;
+	int root_move_idx;       // which root move the path starts with, so its count can be reported per root move
+	int n_path_moves;
+	packed_move path[MAX_SPLIT_DEPTH];
+};
+
+// everything the tasks of one perft run share
+// the work items are only written before the tasks are submitted, after that the tasks only touch the counters, atomically
+struct perft_job {
+	const struct position *root_position;
+	bool is_root_color_white;
+	int depth;
+	struct hash_table *table;
+
+	struct perft_work_item *items;
+	int n_items;
+	int items_capacity;
+
+	volatile uint64_t n_nodes;
+	volatile uint64_t *root_move_nodes;    // the count under each root move, in the order the root moves are generated
+};
+
+static void add_work_item(struct perft_job *job, const struct perft_work_item *item) {
+	if (job->n_items == job->items_capacity) {
+		job->items_capacity = job->items_capacity == 0 ? 256 : job->items_capacity * 2;
+		job->items = realloc(job->items, job->items_capacity * sizeof(job->items[0]));
+		if (job->items == NULL) {
+			fprintf(stderr, "out of memory for %d perft work items\n", job->items_capacity);
+			exit(1);
+		}
+	}
+	job->items[job->n_items] = *item;
+	job->n_items++;
+}
+
+// adds a work item for every sequence of split_depth - item->n_path_moves legal moves following item's path
+// sequences ending early in mate or stalemate have no leaves at the full depth, so they get no item
+static void collect_work_items(struct perft_job *job, struct position *position, struct perft_work_item *item, int split_depth, bool is_color_white) {
+	if (item->n_path_moves == split_depth) {
+		add_work_item(job, item);
+		return;
+	}
+
+	packed_move moves[256];
+	int n_moves = generate_packed_moves_for_color(position, moves, is_color_white);
+
+	for (int i = 0; i < n_moves; i++) {
+		if (item->n_path_moves == 0)
+			item->root_move_idx = i;
+		item->path[item->n_path_moves] = moves[i];
+		item->n_path_moves++;
+
+		struct move move;
+		struct undo_info undo;
+		unpack_move(position, moves[i], &move);
+		make_move(position, &move, &undo);
+		collect_work_items(job, position, item, split_depth, !is_color_white);
+		unmake_move(position, &move, &undo);
+
+		item->n_path_moves--;
+	}
+}
+
+// counts one work item's subtree, on its own copy of the root position
+static void run_perft_work_item(void *item_pointer) {
+	const struct perft_work_item *item = item_pointer;
+	struct perft_job *job = item->job;
+	struct position position = *job->root_position;
+
+	bool is_color_white = job->is_root_color_white;
+	for (int i = 0; i < item->n_path_moves; i++) {
+		struct move move;
+		struct undo_info undo;
+		unpack_move(&position, item->path[i], &move);
+		make_move(&position, &move, &undo);
+		is_color_white = !is_color_white;
+	}
+
+	uint64_t n_nodes = perft(&position, job->depth - item->n_path_moves, is_color_white, job->table);
+
+	atomic_fetch_add_uint64(&job->n_nodes, n_nodes);
+	if (job->root_move_nodes != NULL)
+		atomic_fetch_add_uint64(&job->root_move_nodes[item->root_move_idx], n_nodes);
+}
+
+// perft with every work item counted as a task of pool, the calling thread helps run them while it waits
+// if root_move_nodes is not NULL, the count under every root move is added to it, in the order generate_moves_for_color gives the root moves
+static uint64_t parallel_perft(struct position *position, int depth, bool is_color_white, struct thread_pool *pool, int split_depth, struct hash_table *table, volatile uint64_t *root_move_nodes) {
+	if (depth == 0)
+		return 1;
+
+	if (split_depth > depth)
+		split_depth = depth;
+
+	struct perft_job job = {0};
+	job.root_position = position;
+	job.is_root_color_white = is_color_white;
+	job.depth = depth;
+	job.table = table;
+	job.root_move_nodes = root_move_nodes;
+
+	struct perft_work_item path = {0};
+	path.job = &job;
+	collect_work_items(&job, position, &path, split_depth, is_color_white);
+
+	// the items can't be submitted while they're being collected, the array they're in moves whenever it grows
+	struct task_group group = {0};
+	for (int i = 0; i < job.n_items; i++)
+		submit_task(pool, &group, run_perft_work_item, &job.items[i]);
+	wait_for_task_group(pool, &group);
+
+	free(job.items);
+
+	return job.n_nodes;
+}
+
+// parallel_perft with the count under every root move printed, so a wrong total can be narrowed down to a move
+static uint64_t perft_divide(struct position *position, int depth, bool is_color_white, struct thread_pool *pool, int split_depth, struct hash_table *table) {
+	struct move moves[256];
+	int n_moves = generate_moves_for_color(position, moves, is_color_white, 0);
+
+	uint64_t root_move_nodes[256] = {0};
+	uint64_t n_nodes = parallel_perft(position, depth, is_color_white, pool, split_depth, table, root_move_nodes);
+
+	for (int i = 0; i < n_moves; i++) {
+		char move_str_buf[MOVE_STR_BUF_SIZE];
+		printf("%s: %llu\n", move_str(&moves[i], move_str_buf), (unsigned long long)root_move_nodes[i]);
+	}
+
+	return n_nodes;
+}
+
+static void print_nodes_and_speed(uint64_t n_nodes, double seconds) {
+	double nps = seconds > 0 ? (double)n_nodes / seconds : 0;
+	printf("nodes %llu, time %.3fs, nps %.0f\n", (unsigned long long)n_nodes, seconds, nps);
+}
+
+// runs every position of perft_tests, returns the number of positions whose count was wrong
+static int run_perft_tests(struct thread_pool *pool, int split_depth, struct hash_table *table) {
+	int n_tests = sizeof(perft_tests) / sizeof(perft_tests[0]);
+	int n_failed = 0;
+	uint64_t total_nodes = 0;
+	double total_seconds = 0;
+
+	for (int i = 0; i < n_tests; i++) {
+		const struct perft_test *test = &perft_tests[i];
+
+		struct position position;
+		load_fen_to_position(test->fen, &position);
+
+		double start = wall_clock_seconds();
+		uint64_t n_nodes = parallel_perft(&position, test->depth, is_white_to_move_in_fen(test->fen), pool, split_depth, table, NULL);
+		double seconds = wall_clock_seconds() - start;
+
+		bool is_correct = n_nodes == test->expected_nodes;
+		if (!is_correct)
+			n_failed++;
+
+		printf("%-20s depth %d: %s, ", test->name, test->depth, is_correct ? "ok" : "FAILED");
+		if (!is_correct)
+			printf("expected %llu, ", (unsigned long long)test->expected_nodes);
+		print_nodes_and_speed(n_nodes, seconds);
+
+		total_nodes += n_nodes;
+		total_seconds += seconds;
+	}
+
+	printf("\ntotal: ");
+	print_nodes_and_speed(total_nodes, total_seconds);
+	if (n_failed > 0)
+		printf("%d of %d positions FAILED\n", n_failed, n_tests);
+
+	return n_failed;
+}
+
+static void print_usage(const char *program) {
+	fprintf(stderr, "usage: %s [-threads <n>] [-split <d>] [-hash <mb>] [\"<fen>\" <depth> [expected nodes]]\n", program);
+}
+
+int main(int argc, char **argv) {
+	int n_threads = hardware_thread_count();
+	int split_depth = 2;
+	int hash_megabytes = 64;
+
+	// options come first, everything after them is the fen, depth and expected count
+	int arg_idx = 1;
+	while (arg_idx < argc && argv[arg_idx][0] == '-') {
+		if (arg_idx + 1 >= argc) {
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (strcmp(argv[arg_idx], "-threads") == 0) {
+			n_threads = atoi(argv[arg_idx + 1]);
+		} else if (strcmp(argv[arg_idx], "-split") == 0) {
+			split_depth = atoi(argv[arg_idx + 1]);
+		} else if (strcmp(argv[arg_idx], "-hash") == 0) {
+			hash_megabytes = atoi(argv[arg_idx + 1]);
+		} else {
+			print_usage(argv[0]);
+			return 1;
+		}
+		arg_idx += 2;
+	}
+
+	if (n_threads < 1) {
+		fprintf(stderr, "the thread count must be at least 1, got %d\n", n_threads);
+		return 1;
+	}
+	if (split_depth < 1 || split_depth > MAX_SPLIT_DEPTH) {
+		fprintf(stderr, "the split depth must be between 1 and %d, got %d\n", MAX_SPLIT_DEPTH, split_depth);
+		return 1;
+	}
+
+	if (hash_megabytes < 0) {
+		fprintf(stderr, "the hash size can't be negative, got %d\n", hash_megabytes);
+		return 1;
+	}
+
+	int n_positional_args = argc - arg_idx;
+	if (n_positional_args != 0 && n_positional_args != 2 && n_positional_args != 3) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	int depth = 0;
+	if (n_positional_args != 0) {
+		depth = atoi(argv[arg_idx + 1]);
+		if (depth < 1) {
+			fprintf(stderr, "depth must be at least 1, got '%s'\n", argv[arg_idx + 1]);
+			return 1;
+		}
+	}
+
+	struct hash_table table;
+	init_hash_table(&table, hash_megabytes, 1);
+
+	// the thread running main is the last of the n_threads, it runs tasks while it waits for them
+	struct thread_pool pool;
+	init_thread_pool(&pool, n_threads - 1);
+
+	int result = 0;
+	if (n_positional_args == 0) {
+		printf("%d threads, split depth %d, %d MB hash\n\n", n_threads, split_depth, hash_megabytes);
+		result = run_perft_tests(&pool, split_depth, &table) == 0 ? 0 : 1;
+
+	} else {
+		const char *fen = argv[arg_idx];
+		struct position position;
+		load_fen_to_position(fen, &position);
+
+		double start = wall_clock_seconds();
+		uint64_t n_nodes = perft_divide(&position, depth, is_white_to_move_in_fen(fen), &pool, split_depth, &table);
+		double seconds = wall_clock_seconds() - start;
+
+		printf("\n");
+		print_nodes_and_speed(n_nodes, seconds);
+
+		if (n_positional_args == 3) {
+			uint64_t expected_nodes = strtoull(argv[arg_idx + 2], NULL, 10);
+			if (n_nodes != expected_nodes) {
+				printf("FAILED, expected %llu\n", (unsigned long long)expected_nodes);
+				result = 1;
+			} else {
+				printf("ok\n");
+			}
+		}
+	}
+
+	// the workers are joined before the table they may still be reading goes away
+	free_thread_pool(&pool);
+	free_hash_table(&table);
+	return result;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "platform.h"
+
+double wall_clock_seconds(void) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#if defined(_WIN32)
+int hardware_thread_count(void) {
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return system_info.dwNumberOfProcessors > 0 ? (int)system_info.dwNumberOfProcessors : 1;
+}
+
+static DWORD WINAPI run_thread(LPVOID thread_pointer) {
+	struct thread *thread = thread_pointer;
+	thread->function(thread->argument);
+	return 0;
+}
+
+void start_thread(struct thread *thread, thread_function function, void *argument) {
+	thread->function = function;
+	thread->argument = argument;
+	thread->handle = CreateThread(NULL, 0, run_thread, thread, 0, NULL);
+	if (thread->handle == NULL) {
+		fprintf(stderr, "start_thread: CreateThread failed with error %lu\n", GetLastError());
+		exit(1);
+	}
+}
+
+void join_thread(struct thread *thread) {
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+}
+
+static BOOL CALLBACK run_once_function(PINIT_ONCE init_once, PVOID function, PVOID *context) {
+	(void)init_once;
+	(void)context;
+	((once_function)function)();
+	return TRUE;
+}
+
+void run_once(struct once *once, once_function function) {
+	InitOnceExecuteOnce((PINIT_ONCE)&once->state, run_once_function, (PVOID)function, NULL);
+}
+
+void init_mutex(struct mutex *mutex) {
+	InitializeSRWLock((PSRWLOCK)&mutex->lock);
+}
+
+// an SRWLOCK holds no resources
+void free_mutex(struct mutex *mutex) {
+	(void)mutex;
+}
+
+void lock_mutex(struct mutex *mutex) {
+	AcquireSRWLockExclusive((PSRWLOCK)&mutex->lock);
+}
+
+void unlock_mutex(struct mutex *mutex) {
+	ReleaseSRWLockExclusive((PSRWLOCK)&mutex->lock);
+}
+
+void init_condition(struct condition *condition) {
+	InitializeConditionVariable((PCONDITION_VARIABLE)&condition->variable);
+}
+
+void free_condition(struct condition *condition) {
+	(void)condition;
+}
+
+void wait_condition(struct condition *condition, struct mutex *mutex) {
+	SleepConditionVariableSRW((PCONDITION_VARIABLE)&condition->variable, (PSRWLOCK)&mutex->lock, INFINITE, 0);
+}
+
+void signal_condition(struct condition *condition) {
+	WakeConditionVariable((PCONDITION_VARIABLE)&condition->variable);
+}
+
+void broadcast_condition(struct condition *condition) {
+	WakeAllConditionVariable((PCONDITION_VARIABLE)&condition->variable);
+}
+#else
+int hardware_thread_count(void) {
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	return n_threads > 0 ? (int)n_threads : 1;
+}
+
+static void *run_thread(void *thread_pointer) {
+	struct thread *thread = thread_pointer;
+	thread->function(thread->argument);
+	return NULL;
+}
+
+void start_thread(struct thread *thread, thread_function function, void *argument) {
+	thread->function = function;
+	thread->argument = argument;
+	int error = pthread_create(&thread->handle, NULL, run_thread, thread);
+	if (error != 0) {
+		fprintf(stderr, "start_thread: pthread_create failed with error %d\n", error);
+		exit(1);
+	}
+}
+
+void join_thread(struct thread *thread) {
+	pthread_join(thread->handle, NULL);
+}
+
+void run_once(struct once *once, once_function function) {
+	pthread_once(&once->state, function);
+}
+
+void init_mutex(struct mutex *mutex) {
+	pthread_mutex_init(&mutex->lock, NULL);
+}
+
+void free_mutex(struct mutex *mutex) {
+	pthread_mutex_destroy(&mutex->lock);
+}
+
+void lock_mutex(struct mutex *mutex) {
+	pthread_mutex_lock(&mutex->lock);
+}
+
+void unlock_mutex(struct mutex *mutex) {
+	pthread_mutex_unlock(&mutex->lock);
+}
+
+void init_condition(struct condition *condition) {
+	pthread_cond_init(&condition->variable, NULL);
+}
+
+void free_condition(struct condition *condition) {
+	pthread_cond_destroy(&condition->variable);
+}
+
+void wait_condition(struct condition *condition, struct mutex *mutex) {
+	pthread_cond_wait(&condition->variable, &mutex->lock);
+}
+
+void signal_condition(struct condition *condition) {
+	pthread_cond_signal(&condition->variable);
+}
+
+void broadcast_condition(struct condition *condition) {
+	pthread_cond_broadcast(&condition->variable);
+}
+#endif
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+// the few os facilities the engine and tools need, win32 on windows and posix everywhere else
+
+// wall clock time in seconds, only meaningful as a difference between two calls
+double wall_clock_seconds(void);
+
+// the number of threads the machine can run at once, at least 1
+int hardware_thread_count(void);
+
+typedef void (*thread_function)(void *argument);
+
+struct thread {
+	thread_function function;
+	void *argument;
+#if defined(_WIN32)
+	void *handle;
+#else
+	pthread_t handle;
+#endif
+};
+
+// starts running function(argument) on a new thread, *thread must stay alive until join_thread returns
+void start_thread(struct thread *thread, thread_function function, void *argument);
+
+// waits for the thread's function to return
+void join_thread(struct thread *thread);
+
+// a lock only one thread can hold at a time, and a condition threads holding the lock can sleep on until another thread wakes them
+// on windows these are an SRWLOCK and a CONDITION_VARIABLE, which are both a single pointer
+struct mutex {
+#if defined(_WIN32)
+	void *lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+struct condition {
+#if defined(_WIN32)
+	void *variable;
+#else
+	pthread_cond_t variable;
+#endif
+};
+
+void init_mutex(struct mutex *mutex);
+void free_mutex(struct mutex *mutex);
+void lock_mutex(struct mutex *mutex);
+void unlock_mutex(struct mutex *mutex);
+
+void init_condition(struct condition *condition);
+void free_condition(struct condition *condition);
+
+// unlocks mutex, which the calling thread must hold, sleeps until woken and locks mutex again before returning
+// it can also return without having been woken, so the condition slept on always has to be checked again in a loop
+void wait_condition(struct condition *condition, struct mutex *mutex);
+
+// wakes one of the threads sleeping on condition, or all of them
+void signal_condition(struct condition *condition);
+void broadcast_condition(struct condition *condition);
+
+// makes sure a function runs exactly once, however many threads call run_once with the same struct once at the same time
+// the calls that don't get to run it return only once it has finished
+// a struct once has to start out as ONCE_INIT, statically
+typedef void (*once_function)(void);
+
+struct once {
+#if defined(_WIN32)
+	void *state;    // an INIT_ONCE, a single pointer
+#else
+	pthread_once_t state;
+#endif
+};
+
+#if defined(_WIN32)
+#define ONCE_INIT { NULL }
+#else
+#define ONCE_INIT { PTHREAD_ONCE_INIT }
+#endif
+
+void run_once(struct once *once, once_function function);
+
+// a variable declared THREAD_LOCAL has a separate copy on every thread
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// atomic read-modify-write operations, they return the value from before the operation
+// they are full barriers on both platforms, so they also order the plain memory accesses around them
+#if defined(_MSC_VER)
+static inline int32_t atomic_fetch_add_int32(volatile int32_t *value, int32_t amount) {
+	return (int32_t)_InterlockedExchangeAdd((volatile long *)value, (long)amount);
+}
+
+static inline uint64_t atomic_fetch_add_uint64(volatile uint64_t *value, uint64_t amount) {
+	return (uint64_t)_InterlockedExchangeAdd64((volatile __int64 *)value, (__int64)amount);
+}
+#else
+static inline int32_t atomic_fetch_add_int32(volatile int32_t *value, int32_t amount) {
+	return __atomic_fetch_add(value, amount, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t atomic_fetch_add_uint64(volatile uint64_t *value, uint64_t amount) {
+	return __atomic_fetch_add(value, amount, __ATOMIC_SEQ_CST);
+}
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// xorshift64*, a small fast generator for the places that need a stream of random looking numbers without rand()'s shared state
+// every user keeps its own state, seeded with a fixed value where the numbers have to come out the same on every run
+// the state must never be 0, xorshift would only ever produce 0s from there
+static inline uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
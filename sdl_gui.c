@@ -20,6 +20,11 @@ const uint32_t A_MASK = 0xff000000;
 
 struct overall_game_state {
 	struct game_state game_state; // the logical chess game state
+
+	// the ply shown on the board, the arrow keys go back and forth through the game
+	// pieces can only be moved when it's the game's latest ply
+	int viewed_ply;
+	struct position viewed_position;
 	
 	bool is_player_white;
 	
@@ -168,11 +173,11 @@ void render_chessboard_grid(SDL_Renderer *the_renderer) {
 }
 
 void render_pieces(SDL_Renderer *the_renderer, struct overall_game_state *overall_game_state) {
-	struct position *current_position = overall_game_state->game_state.current_position;
+	struct position *current_position = &overall_game_state->viewed_position;
 	
 	for (int rank = 7; rank >= 0; rank--) {
 		for (int file = 0; file < 8; file++) {
-			if (!current_position->squares[rank][file].has_piece)
+			if (!get_square(current_position, rank, file).has_piece)
 				continue;
 			
 			if (overall_game_state->is_moving_piece && overall_game_state->moving_piece_source_rank == rank && 
@@ -189,8 +194,8 @@ void render_pieces(SDL_Renderer *the_renderer, struct overall_game_state *overal
 			dest_rect.w = 100;
 			dest_rect.h = 100;
 			
-			piece_type piece_type = current_position->squares[rank][file].piece_type;
-			bool is_piece_white = current_position->squares[rank][file].is_piece_white;
+			piece_type piece_type = get_square(current_position, rank, file).piece_type;
+			bool is_piece_white = get_square(current_position, rank, file).is_piece_white;
 			
 			SDL_Texture *piece_texture = texture_from_piece_type_and_color(piece_type, is_piece_white);
 			
@@ -244,11 +249,13 @@ struct move_texture {
 	SDL_Rect dest_rect;
 };
 
-struct move_texture move_list_textures[256];
+// moves past the first MAX_MOVE_LIST_TEXTURES would be drawn below the bottom of the window anyway
+#define MAX_MOVE_LIST_TEXTURES 256
+struct move_texture move_list_textures[MAX_MOVE_LIST_TEXTURES];
 static int n_move_list_textures = 0;
 
-void render_move_list(SDL_Renderer *the_renderer, struct move *moves, int n_moves) {
-	while (n_move_list_textures < n_moves) {
+void render_move_list(SDL_Renderer *the_renderer, const struct game_state *game_state) {
+	while (n_move_list_textures < game_state->n_moves && n_move_list_textures < MAX_MOVE_LIST_TEXTURES) {
 		struct move_texture new_move_texture;
 		
 		new_move_texture.dest_rect.x = 810;
@@ -259,15 +266,19 @@ void render_move_list(SDL_Renderer *the_renderer, struct move *moves, int n_move
 			new_move_texture.dest_rect.y = previous_move_texture.dest_rect.y + font_height;
 		}
 		
-		struct move *new_move = &moves[n_move_list_textures];
+		// the history only keeps packed moves, this rebuilds the full move, check and mate included, once per move
+		struct move new_move_storage;
+		get_game_move_at_ply(game_state, n_move_list_textures, &new_move_storage);
+		struct move *new_move = &new_move_storage;
 		
 		int move_number = (n_move_list_textures + 2) / 2;
 		
-		char buf[32];
+		char move_str_buf[MOVE_STR_BUF_SIZE];
+		char buf[48];
 		if (new_move->is_piece_white) {
-			sprintf(buf, "%d. %s", move_number, move_str(new_move));
+			sprintf(buf, "%d. %s", move_number, move_str(new_move, move_str_buf));
 		} else {
-			sprintf(buf, "%d... %s", move_number, move_str(new_move));
+			sprintf(buf, "%d... %s", move_number, move_str(new_move, move_str_buf));
 		}
 		
 		int text_height, text_width;
@@ -334,6 +345,8 @@ int main(int argc, char *argv[]) {
 	
 	load_piece_textures(the_renderer);
 
+	init_bitboards();
+
 	char *starting_position = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 	
 	struct overall_game_state overall_game_state;
@@ -341,16 +354,15 @@ int main(int argc, char *argv[]) {
 	overall_game_state.is_player_white = true;
 	
 	struct game_state *game_state = &overall_game_state.game_state;
-	game_state->result = GAME_ONGOING;
-	game_state->n_positions = 1;
-	game_state->current_position = &game_state->positions[0];
-	game_state->n_moves = 0;
-	game_state->white_to_move = true;
-	load_fen_to_position(starting_position, game_state->current_position);
+	init_game_state(game_state, starting_position);
+	overall_game_state.viewed_ply = 0;
+	overall_game_state.viewed_position = game_state->current_position;
 	
-	printf("initial position: \n%s\n", position_str(game_state->current_position));
+	char position_str_buf[POSITION_STR_BUF_SIZE];
+	printf("initial position: \n%s\n", position_str(&game_state->current_position, position_str_buf));
 	
-	init_engine();
+	struct engine engine;
+	init_engine(&engine, 64, 0);
 
 	bool running = true;
 
@@ -359,14 +371,16 @@ int main(int argc, char *argv[]) {
 		SDL_RenderClear(the_renderer);
 		render_chessboard_grid(the_renderer);
 		render_pieces(the_renderer, &overall_game_state);
-		render_move_list(the_renderer, game_state->moves, game_state->n_moves);
+		render_move_list(the_renderer, game_state);
 		SDL_RenderPresent(the_renderer);
 				
 		
 		if (game_state->white_to_move != overall_game_state.is_player_white) {
-			struct move engine_move = find_best_move_for_color(game_state->current_position, game_state->white_to_move);
+			struct move engine_move = find_best_move_for_color(&engine, &game_state->current_position, game_state->white_to_move);
 			
 			apply_move_to_game_state(game_state, &engine_move);
+			overall_game_state.viewed_ply = game_state->n_moves;
+			overall_game_state.viewed_position = game_state->current_position;
 			
 			continue;
 		}
@@ -400,10 +414,13 @@ int main(int argc, char *argv[]) {
 						assert(file >= 0);
 						assert(file <= 7);
 						
-						struct position *current_position = game_state->current_position;
+						if (overall_game_state.viewed_ply != game_state->n_moves)
+							break;
+
+						struct position *current_position = &game_state->current_position;
 						
-						if (current_position->squares[rank][file].has_piece) {
-							if (current_position->squares[rank][file].is_piece_white != overall_game_state.is_player_white)
+						if (get_square(current_position, rank, file).has_piece) {
+							if (get_square(current_position, rank, file).is_piece_white != overall_game_state.is_player_white)
 								break;
 							
 							overall_game_state.is_moving_piece = true;
@@ -412,8 +429,8 @@ int main(int argc, char *argv[]) {
 							overall_game_state.moving_piece_source_rank = rank;
 							overall_game_state.moving_piece_source_file = file;
 							
-							piece_type piece_type = current_position->squares[rank][file].piece_type;
-							bool is_piece_white = current_position->squares[rank][file].is_piece_white;
+							piece_type piece_type = get_square(current_position, rank, file).piece_type;
+							bool is_piece_white = get_square(current_position, rank, file).is_piece_white;
 							overall_game_state.moving_piece_texture = texture_from_piece_type_and_color(piece_type, is_piece_white);
 						}
 					}
@@ -448,7 +465,7 @@ int main(int argc, char *argv[]) {
 							break;
 						
 						struct move possible_moves[64];
-						int n_moves = find_all_possible_moves_for_piece(game_state->current_position, possible_moves, source_rank, source_file);
+						int n_moves = find_all_possible_moves_for_piece(&game_state->current_position, possible_moves, source_rank, source_file);
 						
 						for (int move_idx = 0; move_idx < n_moves; move_idx++) {
 							
@@ -458,6 +475,8 @@ int main(int argc, char *argv[]) {
 									the_move->target_rank == target_rank && the_move->target_file == target_file) {
 							
 								apply_move_to_game_state(game_state, the_move);
+								overall_game_state.viewed_ply = game_state->n_moves;
+								overall_game_state.viewed_position = game_state->current_position;
 								break;
 							}
 						}
@@ -490,11 +509,15 @@ int main(int argc, char *argv[]) {
 				SDL_Keycode virtual_key_code = keysym.sym; 
 				
 				if (virtual_key_code == SDLK_LEFT) {
-					if (game_state->current_position != &game_state->positions[0])
-						game_state->current_position--;
+					if (overall_game_state.viewed_ply > 0) {
+						overall_game_state.viewed_ply--;
+						get_game_position_at_ply(game_state, overall_game_state.viewed_ply, &overall_game_state.viewed_position);
+					}
 				} else if (virtual_key_code == SDLK_RIGHT) {
-					if (game_state->current_position != &game_state->positions[game_state->n_positions-1])
-						game_state->current_position++;
+					if (overall_game_state.viewed_ply < game_state->n_moves) {
+						overall_game_state.viewed_ply++;
+						get_game_position_at_ply(game_state, overall_game_state.viewed_ply, &overall_game_state.viewed_position);
+					}
 				}
 			}
 			break;
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "thread_pool.h"
+#include "random.h"
+
+struct thread_pool_worker {
+	struct thread_pool *pool;
+	struct thread thread;
+	struct task_deque deque;
+	uint64_t random_state;    // picks the workers to steal from
+};
+
+// the worker the current thread is, NULL on threads that aren't workers of any pool
+static THREAD_LOCAL struct thread_pool_worker *current_worker;
+
+static void init_task_deque(struct task_deque *deque) {
+	init_mutex(&deque->lock);
+	deque->capacity = 64;
+	deque->tasks = malloc(deque->capacity * sizeof(deque->tasks[0]));
+	if (deque->tasks == NULL) {
+		fprintf(stderr, "out of memory for a task deque\n");
+		exit(1);
+	}
+	deque->first_idx = 0;
+	deque->n_tasks = 0;
+}
+
+static void free_task_deque(struct task_deque *deque) {
+	assert(deque->n_tasks == 0);
+	free(deque->tasks);
+	deque->tasks = NULL;
+	free_mutex(&deque->lock);
+}
+
+static void push_task(struct task_deque *deque, const struct task *task) {
+	lock_mutex(&deque->lock);
+
+	if (deque->n_tasks == deque->capacity) {
+		// the ring is unrolled into the start of the new buffer, oldest task first
+		struct task *tasks = malloc(2 * deque->capacity * sizeof(tasks[0]));
+		if (tasks == NULL) {
+			fprintf(stderr, "out of memory for %d queued tasks\n", 2 * deque->capacity);
+			exit(1);
+		}
+		for (int i = 0; i < deque->n_tasks; i++)
+			tasks[i] = deque->tasks[(deque->first_idx + i) & (deque->capacity - 1)];
+
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->capacity *= 2;
+		deque->first_idx = 0;
+	}
+
+	deque->tasks[(deque->first_idx + deque->n_tasks) & (deque->capacity - 1)] = *task;
+	deque->n_tasks++;
+
+	unlock_mutex(&deque->lock);
+}
+
+// takes the newest task of group if is_newest, the oldest otherwise, of any group if group is NULL
+static bool pop_task(struct task_deque *deque, bool is_newest, const struct task_group *group, struct task *into) {
+	// looked at without the lock first, most deques are empty most of the time and there's no point waiting for their lock
+	if (deque->n_tasks == 0)
+		return false;
+
+	lock_mutex(&deque->lock);
+
+	int mask = deque->capacity - 1;
+	int found = -1;
+	for (int i = 0; i < deque->n_tasks && found < 0; i++) {
+		int offset = is_newest ? deque->n_tasks - 1 - i : i;
+		if (group == NULL || deque->tasks[(deque->first_idx + offset) & mask].group == group)
+			found = offset;
+	}
+
+	if (found >= 0) {
+		*into = deque->tasks[(deque->first_idx + found) & mask];
+
+		// the tasks after it move up to close the gap, without a group it's always the first or last one and nothing moves
+		for (int offset = found; offset < deque->n_tasks - 1; offset++)
+			deque->tasks[(deque->first_idx + offset) & mask] = deque->tasks[(deque->first_idx + offset + 1) & mask];
+		deque->n_tasks--;
+	}
+
+	unlock_mutex(&deque->lock);
+	return found >= 0;
+}
+
+// takes a task for worker to run, or for a thread outside the pool if worker is NULL, only one of group unless group is NULL
+// a worker's own newest task comes first, it's the one whose data is most likely still in the cache
+// otherwise the deques are tried starting at a random one, so the threads looking for work don't all go for the same deque
+static bool take_task(struct thread_pool *pool, struct thread_pool_worker *worker, struct task_group *group, uint64_t *random_state, struct task *into) {
+	if (pool->n_queued_tasks <= 0 || (group != NULL && group->n_queued <= 0))
+		return false;
+
+	bool has_task = worker != NULL && pop_task(&worker->deque, true, group, into);
+
+	// the deques of the workers and the one for tasks submitted from outside the pool, which is the last one
+	int n_deques = pool->n_workers + 1;
+	int first_deque_idx = (int)(next_random(random_state) % (uint64_t)n_deques);
+	for (int i = 0; i < n_deques && !has_task; i++) {
+		int deque_idx = (first_deque_idx + i) % n_deques;
+		struct task_deque *deque = deque_idx < pool->n_workers ? &pool->workers[deque_idx].deque : &pool->submitted;
+		if (worker == NULL || deque != &worker->deque)
+			has_task = pop_task(deque, false, group, into);
+	}
+
+	if (has_task) {
+		atomic_fetch_add_int32(&pool->n_queued_tasks, -1);
+		atomic_fetch_add_int32(&into->group->n_queued, -1);
+	}
+	return has_task;
+}
+
+static void run_task(struct thread_pool *pool, const struct task *task) {
+	task->function(task->argument);
+
+	// the group can be gone as soon as its count reaches 0, the one waiting on it is then free to return
+	if (atomic_fetch_add_int32(&task->group->n_unfinished, -1) == 1) {
+		lock_mutex(&pool->sleep_lock);
+		broadcast_condition(&pool->has_group_changed);
+		unlock_mutex(&pool->sleep_lock);
+	}
+}
+
+static void run_worker(void *worker_pointer) {
+	struct thread_pool_worker *worker = worker_pointer;
+	struct thread_pool *pool = worker->pool;
+	current_worker = worker;
+
+	for (;;) {
+		struct task task;
+		if (take_task(pool, worker, NULL, &worker->random_state, &task)) {
+			run_task(pool, &task);
+			continue;
+		}
+
+		// the count is checked under the lock submit_task signals under, so a task submitted after the check always wakes someone
+		lock_mutex(&pool->sleep_lock);
+		while (pool->n_queued_tasks <= 0 && !pool->is_shutting_down)
+			wait_condition(&pool->has_tasks, &pool->sleep_lock);
+		bool is_done = pool->n_queued_tasks <= 0 && pool->is_shutting_down;
+		unlock_mutex(&pool->sleep_lock);
+
+		if (is_done)
+			break;
+	}
+
+	current_worker = NULL;
+}
+
+void init_thread_pool(struct thread_pool *pool, int n_workers) {
+	assert(n_workers >= 0);
+
+	pool->n_workers = n_workers;
+	pool->n_queued_tasks = 0;
+	pool->is_shutting_down = false;
+	init_task_deque(&pool->submitted);
+	init_mutex(&pool->sleep_lock);
+	init_condition(&pool->has_tasks);
+	init_condition(&pool->has_group_changed);
+
+	pool->workers = NULL;
+	if (n_workers == 0)
+		return;
+
+	pool->workers = calloc((size_t)n_workers, sizeof(pool->workers[0]));
+	if (pool->workers == NULL) {
+		fprintf(stderr, "couldn't allocate a thread pool of %d workers\n", n_workers);
+		exit(1);
+	}
+
+	// every deque has to exist before the first worker starts, workers steal from each other right away
+	for (int i = 0; i < n_workers; i++) {
+		struct thread_pool_worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		init_task_deque(&worker->deque);
+		worker->random_state = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+	}
+	for (int i = 0; i < n_workers; i++)
+		start_thread(&pool->workers[i].thread, run_worker, &pool->workers[i]);
+}
+
+void free_thread_pool(struct thread_pool *pool) {
+	lock_mutex(&pool->sleep_lock);
+	pool->is_shutting_down = true;
+	broadcast_condition(&pool->has_tasks);
+	unlock_mutex(&pool->sleep_lock);
+
+	for (int i = 0; i < pool->n_workers; i++)
+		join_thread(&pool->workers[i].thread);
+
+	// with no workers, the tasks nobody waited for are run here
+	struct task task;
+	uint64_t random_state = 1;
+	while (take_task(pool, NULL, NULL, &random_state, &task))
+		run_task(pool, &task);
+
+	for (int i = 0; i < pool->n_workers; i++)
+		free_task_deque(&pool->workers[i].deque);
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->n_workers = 0;
+
+	free_task_deque(&pool->submitted);
+	free_condition(&pool->has_group_changed);
+	free_condition(&pool->has_tasks);
+	free_mutex(&pool->sleep_lock);
+}
+
+static struct thread_pool shared_pool;
+static struct once shared_pool_once = ONCE_INIT;
+
+static void start_shared_thread_pool(void) {
+	init_thread_pool(&shared_pool, hardware_thread_count() - 1);
+}
+
+struct thread_pool *get_shared_thread_pool(void) {
+	run_once(&shared_pool_once, start_shared_thread_pool);
+	return &shared_pool;
+}
+
+// the calling thread's worker if it's one of pool's
+static struct thread_pool_worker *worker_of_pool(struct thread_pool *pool) {
+	return current_worker != NULL && current_worker->pool == pool ? current_worker : NULL;
+}
+
+void submit_task(struct thread_pool *pool, struct task_group *group, task_function function, void *argument) {
+	struct task task = { function, argument, group };
+	atomic_fetch_add_int32(&group->n_unfinished, 1);
+
+	struct thread_pool_worker *worker = worker_of_pool(pool);
+	atomic_fetch_add_int32(&group->n_queued, 1);
+	atomic_fetch_add_int32(&pool->n_queued_tasks, 1);
+	push_task(worker != NULL ? &worker->deque : &pool->submitted, &task);
+
+	// the thread waiting on the group can run the task as well as an idle worker, whichever gets to it first
+	lock_mutex(&pool->sleep_lock);
+	signal_condition(&pool->has_tasks);
+	broadcast_condition(&pool->has_group_changed);
+	unlock_mutex(&pool->sleep_lock);
+}
+
+void wait_for_task_group(struct thread_pool *pool, struct task_group *group) {
+	struct thread_pool_worker *worker = worker_of_pool(pool);
+	uint64_t random_state = worker != NULL ? worker->random_state : (uint64_t)(uintptr_t)group | 1;
+
+	while (group->n_unfinished > 0) {
+		struct task task;
+		if (take_task(pool, worker, group, &random_state, &task)) {
+			run_task(pool, &task);
+			continue;
+		}
+
+		// nothing of the group left to run, its last tasks are running on other threads
+		lock_mutex(&pool->sleep_lock);
+		while (group->n_unfinished > 0 && group->n_queued <= 0)
+			wait_condition(&pool->has_group_changed, &pool->sleep_lock);
+		unlock_mutex(&pool->sleep_lock);
+	}
+
+	if (worker != NULL)
+		worker->random_state = random_state;
+}
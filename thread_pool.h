@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "platform.h"
+
+// a fixed set of worker threads that run tasks, started once so running work in parallel never has to start a thread
+// every worker has its own deque of tasks, it runs the ones it submitted itself newest first and when it runs out, it steals
+// the oldest task of a randomly picked other worker
+// the threads waiting on a task group run the group's tasks as well while they wait, so a pool with n workers runs tasks on up to
+// n + 1 threads with a single waiting thread, and a pool with 0 workers still works, a group's tasks just run on its waiting thread
+
+typedef void (*task_function)(void *argument);
+
+// a set of tasks that can be waited on together, must be zeroed before its first task is submitted
+// it can be reused once waiting on it has returned
+struct task_group {
+	volatile int32_t n_unfinished;
+	volatile int32_t n_queued;     // of the unfinished tasks, the ones no thread has taken yet
+};
+
+struct task {
+	task_function function;
+	void *argument;
+	struct task_group *group;
+};
+
+// tasks are pushed and popped at the back by the deque's owner and stolen from the front by the other threads
+// a ring buffer that doubles when full, every change is made under the lock, tasks are coarse enough that it's never contended for long
+struct task_deque {
+	struct mutex lock;
+	struct task *tasks;
+	int capacity;             // a power of 2
+	int first_idx;            // of the oldest task, the next one to be stolen
+	volatile int n_tasks;     // also read without the lock, to skip empty deques
+};
+
+struct thread_pool_worker;
+
+struct thread_pool {
+	int n_workers;
+	struct thread_pool_worker *workers;
+
+	// where the tasks submitted by threads that aren't workers of the pool go, any thread takes from its front
+	struct task_deque submitted;
+
+	// tasks in all the deques, counted up before a task is pushed and down once it's been taken
+	volatile int32_t n_queued_tasks;
+
+	// idle workers sleep on has_tasks, threads waiting for a group with nothing of it to run sleep on has_group_changed
+	// which is broadcast whenever a task is queued or a group finishes
+	struct mutex sleep_lock;
+	struct condition has_tasks;
+	struct condition has_group_changed;
+	bool is_shutting_down;
+};
+
+// starts n_workers threads, which sleep until there are tasks to run
+void init_thread_pool(struct thread_pool *pool, int n_workers);
+
+// runs the tasks still queued, then stops the workers and frees what the pool allocated
+void free_thread_pool(struct thread_pool *pool);
+
+// the pool every part of the program that runs things in parallel uses, so they don't start more threads than the machine has
+// between them, it has one worker less than there are hardware threads, the thread waiting on a group being the last one
+// it's started by the first call, from whichever thread makes it
+struct thread_pool *get_shared_thread_pool(void);
+
+// queues function(argument) to run on one of the pool's threads as part of group
+// tasks can submit more tasks and wait on groups themselves
+void submit_task(struct thread_pool *pool, struct task_group *group, task_function function, void *argument);
+
+// returns once every task submitted to group so far has finished, running the group's queued tasks in the meantime
+// only the group's own tasks, a task of another group could run for however long its own group needs, e.g. another engine's
+// search helper, and the wait would last at least as long
+void wait_for_task_group(struct thread_pool *pool, struct task_group *group);
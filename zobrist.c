@@ -0,0 +1,39 @@
+#include <stdint.h>
+
+#include "zobrist.h"
+#include "random.h"
+
+uint64_t zobrist_piece_keys[2][6][64];
+uint64_t zobrist_castling_keys[16];
+uint64_t zobrist_en_passant_keys[8];
+uint64_t zobrist_black_to_move_key;
+
+void init_zobrist_keys(void) {
+	// seeded the same way every time so hashes are the same on every run, e.g. for comparing runs of perft
+	uint64_t random_state = 0x6A09E667F3BCC909ULL;
+
+	for (int color = 0; color < 2; color++) {
+		for (int piece_type = 0; piece_type < 6; piece_type++) {
+			for (int square = 0; square < 64; square++)
+				zobrist_piece_keys[color][piece_type][square] = next_random(&random_state);
+		}
+	}
+
+	// each castling right gets a key and the key of a combination is the xor of its rights' keys
+	// so changing one right is always a single xor, whichever other rights are still there
+	uint64_t castling_right_keys[4];
+	for (int i = 0; i < 4; i++)
+		castling_right_keys[i] = next_random(&random_state);
+	for (int castling_rights = 0; castling_rights < 16; castling_rights++) {
+		zobrist_castling_keys[castling_rights] = 0;
+		for (int i = 0; i < 4; i++) {
+			if (castling_rights & (1 << i))
+				zobrist_castling_keys[castling_rights] ^= castling_right_keys[i];
+		}
+	}
+
+	for (int file = 0; file < 8; file++)
+		zobrist_en_passant_keys[file] = next_random(&random_state);
+
+	zobrist_black_to_move_key = next_random(&random_state);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// random keys whose xor over the features of a position makes its hash, see position_hash
+// piece keys are indexed by [color][piece_type][square], color being COLOR_WHITE or COLOR_BLACK
+extern uint64_t zobrist_piece_keys[2][6][64];
+extern uint64_t zobrist_castling_keys[16];       // indexed by the CASTLE_* bits
+extern uint64_t zobrist_en_passant_keys[8];      // indexed by the file that can be captured en passant on
+extern uint64_t zobrist_black_to_move_key;
+
+// fills in the keys above, called by init_bitboards
+void init_zobrist_keys(void);